@@ -22,6 +22,17 @@
 // Module headers
 #include "fingerprint_gt511.h"
 
+// This driver never uses the heap.  All packets are held in the static
+// memory pool below or in storage provided by the caller, so that the
+// driver can run on a microcontroller without a heap, or in a long
+// running host process without fragmenting one.  Make any use of the
+// heap a compile error.  Other compilers ignore this, so
+// tools/heapcheck.sh also checks the compiled object, and is run for
+// every configuration by tools/footprint.sh.
+#ifdef __GNUC__
+#pragma GCC poison malloc calloc realloc free
+#endif
+
 /**
  * @addtogroup gt511_driver Driver for GT-511C Fingerprint Sensor
  *
@@ -46,6 +57,8 @@
  * - abstracted hardware interface using application-provided read and
  *   write functions
  * - callback functions to inform application of progress and status
+ * - template and image transfer directly to and from application storage,
+ *   with no use of the heap
  *
  * Please refer to the GT-511C sensor data sheet to understand how
  * the functions of this driver should be used.
@@ -79,6 +92,125 @@
  * allows the application to control how long the driver will wait for such
  * events to occur.
  *
+ * ## Multiple Sensors ##
+ *
+ * Every packet carries a device ID.  The stock GT-511C firmware fixes
+ * the device ID at 0x0001 and has no command to change it, so with
+ * stock sensors there can only be one sensor on a serial line, and
+ * GT511_SetDeviceId() should be left alone.  Compatible sensors whose
+ * device ID can be configured can share one half-duplex serial line,
+ * such as RS-485, if each has a different ID.  The application then
+ * selects the sensor with GT511_SetDeviceId() and the driver sends
+ * commands to that ID and only accepts packets from it.  The driver
+ * issues one command at a time and waits for the response, so only one
+ * sensor uses the line at a time.  Control of the line direction is
+ * left to GT511_SendMessage() and GT511_ReceiveMessage().  Sensors that
+ * each have their own serial port can instead search for a template at
+ * the same time, see GT511_IdentifyTemplateShards().  Saved state such
+ * as the finger press cache belongs to one sensor, so it is forgotten
+ * when the device ID changes.
+ *
+ * The saved state of a sensor can be copied out with GT511_SaveState()
+ * and loaded again with GT511_RestoreState().  This allows a process to
+ * hand a sensor over to another process, or to switch between sensors
+ * on one line, without opening the sensor again or losing cached
+ * information such as template hashes.
+ *
+ * ## Configuration ##
+ *
+ * Groups of features can be left out of the build to save code and data
+ * space on small microcontrollers.  Each group is controlled by a macro
+ * that can be set to 0 on the compiler command line.  All groups are
+ * enabled by default.  See fingerprint_gt511.h for details.
+ *
+ * - GT511_ENABLE_RUN_FLOWS - enroll, identify and verify processes
+ * - GT511_ENABLE_TEMPLATE_IO - template upload and download
+ * - GT511_ENABLE_IMAGE_IO - fingerprint image download
+ * - GT511_ENABLE_INFO - sensor info returned by GT511_Open()
+ * - GT511_ENABLE_STATS - driver statistics
+ * - GT511_ENABLE_ERROR_STRINGS - error code names for logging
+ * - GT511_ENABLE_TRACE - command tracing
+ * - GT511_ENABLE_EVENT_QUEUE - queued delivery of driver events
+ * - GT511_ENABLE_STANDBY - low power standby
+ *
+ * The core commands are always included.  The script tools/footprint.sh
+ * reports the code and static RAM size of each configuration.
+ *
+ * ## Clock ##
+ *
+ * The application can optionally provide a clock to the driver by
+ * calling GT511_SetClock().  The clock is used to measure latencies
+ * reported in the driver statistics, and to sleep between polls of the
+ * sensor while waiting for a finger press or release.  If no clock is
+ * provided then the driver polls continuously and reports zero for all
+ * time measurements.  All driver timing goes through the application
+ * timeout functions and this clock, so a simulated sensor and a virtual
+ * clock can be used to run the driver faster than real time.
+ *
+ * ## Standby ##
+ *
+ * A reader that is polled continuously keeps the sensor, its LED and the
+ * host awake.  GT511_Standby() turns off the LED and closes the sensor,
+ * and GT511_Resume() opens it again without requesting the sensor info,
+ * and restores the LED.  Cached state such as template hashes is kept.
+ * The application can instead call GT511_Idle() from its idle loop, and
+ * the driver then enters standby when no command has been issued for
+ * the time set by GT511_SetStandby(), and resumes when the application
+ * wake function says so.  GT511_GetPowerStats() reports the time spent
+ * in standby and how long it takes the reader to be ready after a wake.
+ *
+ * ## Tracing ##
+ *
+ * The application can register a trace function with GT511_SetTrace().
+ * It is called with a GT511_TraceRecord_t after every command and data
+ * packet exchanged with the sensor, giving the command, parameters,
+ * result, and the times the command was sent and the response received.
+ * Data packets received from the sensor, such as templates and images,
+ * get a record of their own after the record of the command that asked
+ * for them.
+ * Traces recorded from real sensors can be used to measure how long
+ * each command takes, for example to set the latencies of a simulated
+ * sensor.  Tracing costs nothing beyond a test of the function pointer
+ * when no trace function is registered.
+ *
+ * ## Fault Injection ##
+ *
+ * If the driver is built with GT511_FAULT_INJECTION defined, then faults
+ * can be injected into messages received from the sensor, on a repeatable
+ * schedule set by GT511_SetFaultInjection().  The faults are dropped
+ * bytes, noise ahead of the packet header, flipped bits, truncated
+ * messages, and stalls.  GT511_GetFaultStats() reports the time taken to
+ * recover, and the number of commands that failed, so that recovery can
+ * be measured against a simulated sensor.  This should not be enabled in
+ * a production build.
+ *
+ * ## Large Galleries ##
+ *
+ * The sensor holds only GT511_NUM_SLOTS fingerprints.  Identification
+ * against a larger population must be done by host software, and this
+ * driver provides the pieces needed to feed it rather than a matcher of
+ * its own.  A host can:
+ *
+ * - download images with GT511_GetImage() and reject poor placements
+ *   with GT511_ImageCoverage() before extracting features
+ * - export enrolled templates with GT511_GetTemplateStream() into a
+ *   host gallery, without first copying them into a single buffer
+ * - check a short list of candidates from its own index on the sensor,
+ *   by loading each one into a scratch slot with
+ *   GT511_SetTemplateStream() and matching the finger against that slot
+ *   with GT511_Verify()
+ *
+ * GT511_SetTemplateStream() overwrites whatever is enrolled in the slot,
+ * so candidates must only ever be loaded into slots that the application
+ * has set aside for this and never enrolls into.  If no slot can be set
+ * aside then the template in the slot must be saved with
+ * GT511_GetTemplate() first and put back with GT511_SetTemplate() once
+ * the check is done, including when the check fails part way.  Otherwise
+ * the enrolled fingerprint is lost.
+ *
+ * Indexing, feature extraction and scoring of the gallery belong to the
+ * host and are not part of this driver.
+ *
  * ## Application Callback ##
  *
  * The driver will call an application-provided callback function to supply
@@ -87,6 +219,18 @@
  * application to know at what points it is appropriate to prompt the user
  * to do some action such as touch the sensor.
  *
+ * The callback is called from within the driver, so a slow callback
+ * delays polling of the sensor.  To avoid this the application can call
+ * GT511_SetEventQueue() so that the driver instead places events in a
+ * queue, and then take them from the queue with GT511_GetEvent() on its
+ * own thread or main loop.  The queue has a single producer (the driver)
+ * and a single consumer (the application), and needs no locking.  If the
+ * application falls behind and the queue fills, the driver does not
+ * wait.  The new event is either discarded or delivered by the callback,
+ * depending on the overflow setting.  Queued accept and reject events
+ * also carry the ID, the device ID and the time, so the application can
+ * write an access log from its own thread without slowing the reader.
+ *
  * ## Typical API Usage ##
  *
  * All of the functions are written using the same style and all have the
@@ -125,11 +269,97 @@
  */
 
 /**
- * Set the number of supported fingerprint slots.
- * This should match the capability of your sensor hardware.
+ * Set the device ID of the sensor used when the driver starts.  Refer to
+ * GT511_SetDeviceId().
+ */
+#ifndef GT511_DEVICE_ID
+#define GT511_DEVICE_ID 1
+#endif
+
+/**
+ * Set the default press/release confirmation used during enrollment.
+ * The values are _confirmCount_, _windowCount_ and _dwellCount_ of
+ * GT511_Debounce_t.  Enrollment is stricter because a poor capture
+ * spoils the stored template.
+ */
+#ifndef GT511_DEBOUNCE_ENROLL
+#define GT511_DEBOUNCE_ENROLL { 3, 4, 2 }
+#endif
+
+/**
+ * Set the default press/release confirmation used during identification,
+ * verification and capture.  See GT511_DEBOUNCE_ENROLL.
+ */
+#ifndef GT511_DEBOUNCE_IDENTIFY
+#define GT511_DEBOUNCE_IDENTIFY { 2, 3, 1 }
+#endif
+
+/**
+ * Set whether identification and verification use a high quality
+ * capture when a fast capture is not good enough.  Refer to
+ * GT511_SetCaptureEscalation().
+ */
+#ifndef GT511_CAPTURE_ESCALATION
+#define GT511_CAPTURE_ESCALATION true
+#endif
+
+/**
+ * Set the block size in pixels, and the pixel variance above which a
+ * block counts as part of the fingerprint, used by
+ * GT511_ImageCoverage().  The block sums are kept in 32 bits, which
+ * holds the sum of squares of up to 256 x 256 pixels.
+ */
+#ifndef GT511_SEGMENT_BLOCK
+#define GT511_SEGMENT_BLOCK 8
+#endif
+#if (GT511_SEGMENT_BLOCK < 1) || (GT511_SEGMENT_BLOCK > 256)
+#error "GT511_SEGMENT_BLOCK must be from 1 to 256"
+#endif
+#ifndef GT511_SEGMENT_THRESHOLD
+#define GT511_SEGMENT_THRESHOLD 100
+#endif
+
+/**
+ * Set the number of different commands that GT511_GetCommandStats() keeps
+ * figures for.  Commands are added to the table as they are first used.
+ */
+#ifndef GT511_COMMAND_STATS_SIZE
+#define GT511_COMMAND_STATS_SIZE 16
+#endif
+
+/**
+ * Set the weight given to each new sample in the rolling averages of
+ * GT511_GetCommandStats(), as a power of 2.  The default of 3 gives
+ * each new sample a weight of 1/8.
+ */
+#ifndef GT511_STATS_EWMA_SHIFT
+#define GT511_STATS_EWMA_SHIFT 3
+#endif
+
+/**
+ * Set the number of events held by the event queue.  Refer to
+ * GT511_SetEventQueue().  This must be a power of 2.
+ */
+#ifndef GT511_EVENT_QUEUE_SIZE
+#define GT511_EVENT_QUEUE_SIZE 8
+#endif
+
+/**
+ * Set the number of times GT511_RevokeID() tries to delete an ID before
+ * giving up.
+ */
+#ifndef GT511_REVOKE_ATTEMPTS
+#define GT511_REVOKE_ATTEMPTS 3
+#endif
+
+/**
+ * Set the number of bytes of a template that are transferred at a time
+ * by the streaming template functions such as GT511_GetTemplateStream(),
+ * and of a raw image by GT511_CaptureBaseline().  This sets the amount
+ * of stack used for the transfer.
  */
-#ifndef GT511_NUM_SLOTS
-#define GT511_NUM_SLOTS 20
+#ifndef GT511_STREAM_CHUNK_SIZE
+#define GT511_STREAM_CHUNK_SIZE 32
 #endif
 
 /******************************************************************************
@@ -196,26 +426,162 @@ typedef struct
     uint16_t checksum;
 } GT511_Packet_t;
 
-// GT-511C data packet format.  The payload is variable length so
-// the actual location of the checksum cannot be coded into the structure.
+// GT-511C data packet header.  The payload is variable length so it
+// is not part of the structure.  The payload is followed by a 16-bit
+// checksum of the header and payload.
 typedef struct
 {
     uint8_t start1;
     uint8_t start2;
     uint16_t id;
-    uint8_t payload[2];
-    // uint16_t checksum;
 } GT511_DataPacket_t;
 
 /*
  * Memory pool for packets used by this module.
- * This memory is shared by the different types of packets.
  * This is enough memory to hold the command packet and response
- * packets (but not at the same time), or the data packet returned
- * from an "open" command (the info packet).  Any other data such as
- * templates will need a separate memory allocation.
+ * packets (but not at the same time).  Data packets such as the info
+ * packet, templates and images are transferred directly between the
+ * serial port and the caller's storage, so the pool does not grow with
+ * the enabled features.
+ */
+static uint8_t mempool[sizeof(GT511_Packet_t)];
+
+// Number of driver modes, used to size the per-mode tables
+#define NUM_MODES (GT511_MODE_ENROLL + 1)
+
+// Optional application clock functions
+static GT511_GetTicks_t pfnAppGetTicks = NULL;
+static GT511_Sleep_t pfnAppSleep = NULL;
+
+// Device ID of the sensor that commands are sent to
+static uint16_t deviceId = GT511_DEVICE_ID;
+
+// Backlight state most recently set by GT511_CmosLed()
+static bool ledOn = false;
+
+// Most recent finger press state read from the sensor, and when it was
+// read.  Used by GT511_IsPressFingerCached().
+static bool pressCacheValid = false;
+static bool pressCacheState;
+static uint32_t pressCacheTicks;
+
+#if GT511_ENABLE_STATS
+// Rolling figures for each command.  The averages are held with 4 extra
+// bits of fraction so that small latencies are not lost to rounding.
+typedef struct
+{
+    uint16_t command;
+    GT511_CommandStats_t stats;
+    uint32_t avgTicks16;
+    uint32_t failRate16;
+} CommandStats_t;
+static CommandStats_t commandStats[GT511_COMMAND_STATS_SIZE];
+static uint32_t commandStatsCount = 0;
+#endif
+
+#if GT511_ENABLE_STANDBY
+// Standby state.  The LED state is saved on entry to standby so that it
+// can be restored on resume.  The time of the most recent command is
+// used to enter standby after a period of idle.
+static bool inStandby = false;
+static bool standbyLedOn;
+static uint32_t standbyIdleTicks = 0;
+static GT511_Wake_t pfnAppWake = NULL;
+static void *pWakeContext;
+static uint32_t lastCommandTicks;
+static uint32_t powerMarkTicks;
+static GT511_PowerStats_t powerStats;
+#endif
+
+#if GT511_ENABLE_TRACE
+// Optional application trace function, and its context
+static GT511_Trace_t pfnAppTrace = NULL;
+static void *pTraceContext;
+
+// Trace record sequence number, and the process (flow) that commands
+// belong to.  Flows are numbered from 1, and nest so that a flow that
+// runs another is traced as one.
+static uint32_t traceSequence = 0;
+static GT511_Mode_t flowMode = GT511_MODE_IDLE;
+static uint32_t flowNumber = 0;
+static uint32_t flowDepth = 0;
+#endif
+
+#if GT511_ENABLE_TEMPLATE_IO
+// Hash of the template enrolled at each ID, and a flag for each ID that
+// has a known hash.  Used by GT511_GetTemplateHash().
+static GT511_Hash_t templateHash[GT511_NUM_SLOTS];
+static uint32_t templateHashValid[(GT511_NUM_SLOTS + 31) / 32];
+#endif
+
+#if GT511_ENABLE_RUN_FLOWS
+// Press/release confirmation settings for each mode.  Idle mode accepts
+// the first poll, which matches the original driver behavior.
+static GT511_Debounce_t debounce[NUM_MODES] =
+{
+    { 1, 1, 1 },                // GT511_MODE_IDLE
+    GT511_DEBOUNCE_IDENTIFY,    // GT511_MODE_IDENTIFY
+    GT511_DEBOUNCE_IDENTIFY,    // GT511_MODE_VERIFY
+    GT511_DEBOUNCE_IDENTIFY,    // GT511_MODE_CAPTURE
+    GT511_DEBOUNCE_ENROLL,      // GT511_MODE_ENROLL
+};
+
+// Interval between sensor polls while waiting for press or release
+static uint32_t pollInterval = 0;
+
+// Driver timeout for waiting on a press or release in each mode, in
+// clock ticks.  Zero means only the application timeout is used.
+static uint32_t waitTimeout[NUM_MODES];
+
+// Whether identify and verify start with a fast capture and escalate to
+// a high quality capture, whether the last match was rejected so the next
+// attempt escalates, and a flag for each ID that has needed a high
+// quality capture to match.
+static bool captureEscalation = GT511_CAPTURE_ESCALATION;
+static bool escalateNext;
+static uint32_t preferHighQuality[(GT511_NUM_SLOTS + 31) / 32];
+
+#if GT511_ENABLE_STATS
+// Press detection and capture statistics for each mode
+static GT511_PressStats_t pressStats[NUM_MODES];
+#endif
+
+#if GT511_ENABLE_EVENT_QUEUE
+#if (GT511_EVENT_QUEUE_SIZE & (GT511_EVENT_QUEUE_SIZE - 1)) != 0
+#error "GT511_EVENT_QUEUE_SIZE must be a power of 2"
+#endif
+
+// Queue of events waiting for the application.  The head is only written
+// by the driver and the tail only by the application, and both count up
+// without wrapping to the queue size.
+static GT511_Event_t eventQueue[GT511_EVENT_QUEUE_SIZE];
+static volatile uint32_t eventHead;
+static volatile uint32_t eventTail;
+static bool eventQueueEnabled = false;
+static GT511_Overflow_t eventOverflow;
+static GT511_EventStats_t eventStats;
+
+// Make sure an event is fully written or read before the queue index
+// that hands it over is updated, when the producer and consumer run on
+// different cores.
+#ifdef __GNUC__
+#define EventBarrier() __sync_synchronize()
+#else
+#define EventBarrier()
+#endif
+#endif
+#endif
+
+/*
+ * Read the application clock.
+ *
+ * @return the current time in ticks, or 0 if there is no clock.
  */
-static uint8_t mempool[sizeof(GT511_DataPacket_t) + sizeof(GT511_Info_t)];
+static uint32_t
+GetTicks(void)
+{
+    return pfnAppGetTicks ? pfnAppGetTicks() : 0;
+}
 
 /*
  * Compute the checksum of a buffer.
@@ -238,6 +604,163 @@ Checksum(uint8_t *pBuf, uint32_t length)
     return sum;
 }
 
+#ifdef GT511_FAULT_INJECTION
+// Fault injection settings, schedule and statistics
+static GT511_FaultConfig_t faultConfig;
+static GT511_FaultStats_t faultStats;
+static uint32_t faultRandom;
+static bool faultPending = false;
+static uint32_t faultTicks;
+
+// Message bytes displaced by inserted noise, which are delivered at
+// the start of the next receive as they would be by a real serial port
+static uint8_t faultHeld[4];
+static uint32_t faultHeldCount = 0;
+
+/*
+ * Get the next number in the fault schedule.
+ *
+ * @return a pseudo-random number from 0 to 32767.
+ */
+static uint32_t
+FaultRandom(void)
+{
+    faultRandom = faultRandom * 1103515245 + 12345;
+    return (faultRandom >> 16) & 0x7FFF;
+}
+
+/*
+ * Decide if a fault should be injected.
+ *
+ * @param rate the chance of the fault in parts per thousand
+ *
+ * The fault is counted when this returns true, so it must only be
+ * called when the fault can actually be applied.
+ *
+ * @return **true** if the fault should be injected.
+ */
+static bool
+FaultChance(uint16_t rate)
+{
+    if (rate && ((FaultRandom() % 1000) < rate))
+    {
+        ++faultStats.faultCount;
+        if (!faultPending)
+        {
+            faultPending = true;
+            faultTicks = GetTicks();
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Receive a message from the sensor and apply any scheduled faults.
+ *
+ * @param pMessage points at storage for the incoming message
+ * @param length number of expected bytes in the message
+ *
+ * This is used in place of GT511_ReceiveMessage() when fault injection
+ * is enabled.
+ *
+ * @return The number of bytes stored at pMessage.
+ */
+static uint32_t
+ReceiveMessage(uint8_t *pMessage, uint32_t length)
+{
+    // stall for a random time up to the maximum
+    if (pfnAppSleep && FaultChance(faultConfig.stallRate))
+    {
+        pfnAppSleep(FaultRandom() % (faultConfig.stallTicks + 1));
+    }
+
+    // deliver any bytes held back from the previous message first
+    uint32_t count = (faultHeldCount < length) ? faultHeldCount : length;
+    memcpy(pMessage, faultHeld, count);
+    faultHeldCount -= count;
+    memmove(faultHeld, &faultHeld[count], faultHeldCount);
+    count += GT511_ReceiveMessage(&pMessage[count], length - count);
+    if (count != length)
+    {
+        return count;
+    }
+
+    // insert noise ahead of the message, holding back the bytes that
+    // are pushed out of the end
+    if ((faultHeldCount == 0) && FaultChance(faultConfig.garbageRate))
+    {
+        uint32_t noise = 1 + (FaultRandom() % sizeof(faultHeld));
+        noise = (noise < length) ? noise : length;
+        memcpy(faultHeld, &pMessage[length - noise], noise);
+        faultHeldCount = noise;
+        memmove(&pMessage[noise], pMessage, length - noise);
+        for (uint32_t i = 0; i < noise; i++)
+        {
+            pMessage[i] = FaultRandom();
+        }
+    }
+
+    // flip a bit somewhere in the message
+    if (FaultChance(faultConfig.bitFlipRate))
+    {
+        pMessage[FaultRandom() % length] ^= 1 << (FaultRandom() % 8);
+    }
+
+    // drop one byte
+    if (FaultChance(faultConfig.dropRate))
+    {
+        uint32_t idx = FaultRandom() % length;
+        memmove(&pMessage[idx], &pMessage[idx + 1], length - idx - 1);
+        count = length - 1;
+    }
+
+    // cut the message short
+    else if (FaultChance(faultConfig.truncateRate))
+    {
+        count = FaultRandom() % length;
+    }
+
+    return count;
+}
+
+/*
+ * Update the fault statistics with the result of a command.
+ *
+ * @param err the result of the command
+ *
+ * A command that gets a valid response, even a NACK, means that the
+ * driver has recovered from any earlier faults.
+ */
+static void
+FaultCommandDone(GT511_Error_t err)
+{
+    ++faultStats.commandCount;
+    if (!faultPending)
+    {
+        return;
+    }
+
+    if (err == GT511_ERR_OTHER_ERROR)
+    {
+        ++faultStats.failedCount;
+    }
+    else
+    {
+        uint32_t ticks = GetTicks() - faultTicks;
+        ++faultStats.recoveryCount;
+        faultStats.recoveryTicks += ticks;
+        if (ticks > faultStats.maxRecoveryTicks)
+        {
+            faultStats.maxRecoveryTicks = ticks;
+        }
+        faultPending = false;
+    }
+}
+#else
+#define ReceiveMessage GT511_ReceiveMessage
+#endif
+
 /*
  * Test a response packet for validity.
  *
@@ -265,8 +788,8 @@ IsValidResponse(GT511_Packet_t *pResp)
         return false;
     }
 
-    // Check the ID which is always 1
-    if (pResp->id != 1)
+    // Check the response came from the selected sensor
+    if (pResp->id != deviceId)
     {
         return false;
     }
@@ -282,48 +805,80 @@ IsValidResponse(GT511_Packet_t *pResp)
 }
 
 /*
- * Issue a command and check response.
+ * Receive a response packet from the sensor.
  *
- * @param command specific GT511 command code to send to reader
- * @param pParameter points at storage for command and response parameter
+ * @param pResp storage for the response packet
  *
- * Prepares a command packet and sends it to the GT511 reader.  It then
- * receives a response packet and validates it.  If everything is valid
- * and there is an ACK response, then the parameter can be returned.
- * The argument _pParameter_ is used for both passing in a parameter to be
- * used for the command, and to return a parameter from the response, if
- * any.  This argument can be NULL in which case 0 will be used for the
- * command parameter and no response parameter can be returned.
+ * Noise on the serial line can be received ahead of the response packet.
+ * If the packet header is not at the start of the received bytes, then
+ * the header is located and the rest of the packet is read so that the
+ * driver stays in step with the sensor.
  *
- * @return **GT511_ERR_NONE** if the command is sent successfully and a
- * correct response is received with an ACK.  If the response contains a
- * NACK, then the response error code is returned.  If any other error
- * occurs (bad communication, invalid packet, etc) then
- * **GT511_ERR_OTHER_ERROR** is returned.
+ * @return **true** if a complete packet was received.  The packet still
+ * needs to be validated.
  */
-static GT511_Error_t
-IssueCommand(uint16_t command, uint32_t *pParameter)
+static bool
+ReceiveResponse(GT511_Packet_t *pResp)
 {
-    // Prepare a command packet
-    GT511_Packet_t *pCmd = (GT511_Packet_t *)mempool;
-    pCmd->start1 = 0x55;
-    pCmd->start2 = 0xAA;
-    pCmd->id = 1;
-    pCmd->parameter = (pParameter != NULL) ? *pParameter : 0;
-    pCmd->command = command;
-    pCmd->checksum = Checksum((uint8_t *)pCmd, sizeof(GT511_Packet_t) - 2);
+    uint8_t *pBuf = (uint8_t *)pResp;
+    uint32_t length = sizeof(GT511_Packet_t);
+    uint32_t count = ReceiveMessage(pBuf, length);
+    if (count != length)
+    {
+        return false;
+    }
 
-    // Send the prepared command and check for send error
-    bool ok = GT511_SendMessage((uint8_t *)pCmd, sizeof(GT511_Packet_t));
-    if (!ok)
+    // find the start of the packet header
+    uint32_t offset = 0;
+    while (offset < length)
     {
-        return GT511_ERR_OTHER_ERROR;
+        if ((pBuf[offset] == 0x55)
+         && ((offset == (length - 1)) || (pBuf[offset + 1] == 0xAA)))
+        {
+            break;
+        }
+        ++offset;
+    }
+    if (offset == length)
+    {
+        return false;
+    }
+
+    // if there was noise ahead of the header then read the rest
+    if (offset != 0)
+    {
+        ConsolePrintf("skipped %u bytes ahead of response\n", (unsigned int)offset);
+        memmove(pBuf, &pBuf[offset], length - offset);
+        count = ReceiveMessage(&pBuf[length - offset], offset);
+        if (count != offset)
+        {
+            return false;
+        }
     }
+    return true;
+}
 
+/*
+ * Receive a response packet and check for ACK.
+ *
+ * @param pParameter points at storage for the response parameter
+ *
+ * Receives a response packet and validates it.  If everything is valid
+ * and there is an ACK response, then the parameter is returned through
+ * _pParameter_, which can be NULL if not needed.
+ *
+ * @return **GT511_ERR_NONE** if a correct response is received with an
+ * ACK.  If the response contains a NACK, then the response error code is
+ * returned.  If any other error occurs (bad communication, invalid
+ * packet, etc) then **GT511_ERR_OTHER_ERROR** is returned.
+ */
+static GT511_Error_t
+ReceiveAck(uint32_t *pParameter)
+{
     // Try to receive a response packet
     GT511_Packet_t *pResp = (GT511_Packet_t *)mempool;
-    uint32_t respCount = GT511_ReceiveMessage((uint8_t *)pResp, sizeof(GT511_Packet_t));
-    if (respCount != sizeof(GT511_Packet_t))
+    bool ok = ReceiveResponse(pResp);
+    if (!ok)
     {
         return GT511_ERR_OTHER_ERROR;
     }
@@ -356,571 +911,3172 @@ IssueCommand(uint16_t command, uint32_t *pParameter)
 }
 
 /*
- * Wait for user to touch finger to sensor.
+ * Send a command packet and receive the response.
  *
- * @param mode the current mode of the driver (identify, enroll, etc)
+ * @param command specific GT511 command code to send to reader
+ * @param pParameter points at storage for command and response parameter
  *
- * This function will use the GT511_UserCallback() to prompt the user
- * to press the sensor, and to then wait for the user to press the
- * sensor.  At the start GT511_SetTimeout() will be called to allow the
- * application set a timeout if needed.  While waiting then
- * GT511_CheckTimeout() will be repeatedly called to see if a timeout
- * occurs.  This function will wait until either it correctly detects a
- * finger touch, or the timeout occurs, or some other error happens.
+ * Prepares a command packet and sends it to the GT511 reader.  It then
+ * receives a response packet and validates it.  If everything is valid
+ * and there is an ACK response, then the parameter can be returned.
+ * The argument _pParameter_ is used for both passing in a parameter to be
+ * used for the command, and to return a parameter from the response, if
+ * any.  This argument can be NULL in which case 0 will be used for the
+ * command parameter and no response parameter can be returned.
  *
- * @return **GT511_ERR_NONE** if a touch was detected.  If the timeout
- * happens then it will return **GT511_ERR_OTHER_ERROR**.  If any other
- * error occurs then that code will be returned.  The function was not
- * successful at detecting a touch if anything other than GT511_ERR_NONE
- * is returned.
+ * @return **GT511_ERR_NONE** if the command is sent successfully and a
+ * correct response is received with an ACK.  If the response contains a
+ * NACK, then the response error code is returned.  If any other error
+ * occurs (bad communication, invalid packet, etc) then
+ * **GT511_ERR_OTHER_ERROR** is returned.
  */
 static GT511_Error_t
-WaitFingerPress(GT511_Mode_t mode)
+ExchangeCommand(uint16_t command, uint32_t *pParameter)
 {
-    GT511_Error_t err;
-    // wait for a finger press
-    GT511_UserCallback(mode, GT511_UI_PRESS);
-    ConsolePrintf("waiting for touch\n");
-    bool isPressed = false;
-    GT511_SetTimeout(mode);
-    do
-    {
-        // check for timeout from app
-        bool timeout = GT511_CheckTimeout(mode);
-        if (timeout)
+    // Prepare a command packet
+    GT511_Packet_t *pCmd = (GT511_Packet_t *)mempool;
+    pCmd->start1 = 0x55;
+    pCmd->start2 = 0xAA;
+    pCmd->id = deviceId;
+    pCmd->parameter = (pParameter != NULL) ? *pParameter : 0;
+    pCmd->command = command;
+    pCmd->checksum = Checksum((uint8_t *)pCmd, sizeof(GT511_Packet_t) - 2);
+
+    // Send the prepared command and check for send error
+    bool ok = GT511_SendMessage((uint8_t *)pCmd, sizeof(GT511_Packet_t));
+    if (!ok)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    return ReceiveAck(pParameter);
+}
+
+#if GT511_ENABLE_STATS
+/*
+ * Find the statistics entry for a command.
+ *
+ * @param command the command code, or GT511_TRACE_DATA for a data packet
+ * @param add true to add an entry if the command has none
+ *
+ * @return the entry, or NULL if there is none.
+ */
+static CommandStats_t *
+FindCommandStats(uint16_t command, bool add)
+{
+    for (uint32_t idx = 0; idx < commandStatsCount; idx++)
+    {
+        if (commandStats[idx].command == command)
+        {
+            return &commandStats[idx];
+        }
+    }
+    if (!add || (commandStatsCount >= GT511_COMMAND_STATS_SIZE))
+    {
+        return NULL;
+    }
+    CommandStats_t *pEntry = &commandStats[commandStatsCount++];
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->command = command;
+    return pEntry;
+}
+
+/*
+ * Update a rolling average, held with 4 bits of fraction.
+ *
+ * @param avg16 the current average
+ * @param sample the new sample
+ * @param first true if this is the first sample
+ *
+ * @return the new average.
+ */
+static uint32_t
+UpdateAverage(uint32_t avg16, uint32_t sample, bool first)
+{
+    uint32_t sample16 = sample << 4;
+    if (first)
+    {
+        return sample16;
+    }
+    if (sample16 >= avg16)
+    {
+        return avg16 + ((sample16 - avg16) >> GT511_STATS_EWMA_SHIFT);
+    }
+    return avg16 - ((avg16 - sample16) >> GT511_STATS_EWMA_SHIFT);
+}
+
+/*
+ * Update the statistics for a command.
+ *
+ * @param command the command code, or GT511_TRACE_DATA for a data packet
+ * @param err the result of the command
+ * @param ticks the time taken by the command
+ */
+static void
+UpdateCommandStats(uint16_t command, GT511_Error_t err, uint32_t ticks)
+{
+    CommandStats_t *pEntry = FindCommandStats(command, true);
+    if (!pEntry)
+    {
+        return;
+    }
+
+    bool first = (pEntry->stats.count == 0);
+    bool failed = (err == GT511_ERR_OTHER_ERROR) || (err == GT511_ERR_BAD_FINGER);
+    ++pEntry->stats.count;
+    if (failed)
+    {
+        ++pEntry->stats.failCount;
+    }
+    else if (err != GT511_ERR_NONE)
+    {
+        ++pEntry->stats.nackCount;
+    }
+    if (ticks > pEntry->stats.maxTicks)
+    {
+        pEntry->stats.maxTicks = ticks;
+    }
+    pEntry->avgTicks16 = UpdateAverage(pEntry->avgTicks16, ticks, first);
+    pEntry->failRate16 = UpdateAverage(pEntry->failRate16, failed ? 1000 : 0, first);
+}
+#endif
+
+#if GT511_ENABLE_TRACE
+/*
+ * Pass a trace record for an exchange with the sensor to the
+ * application trace function, if there is one.
+ *
+ * @param command the command code, or GT511_TRACE_DATA for a data packet
+ * @param parameter the command parameter, or the data packet length
+ * @param response the response parameter
+ * @param err the result of the exchange
+ * @param startTicks the time the exchange started
+ * @param endTicks the time the exchange ended
+ * @param received true for a data packet received from the sensor
+ */
+static void
+TraceExchange(uint16_t command, uint32_t parameter, uint32_t response,
+              GT511_Error_t err, uint32_t startTicks, uint32_t endTicks,
+              bool received)
+{
+    if (pfnAppTrace)
+    {
+        GT511_TraceRecord_t record;
+        record.command = command;
+        record.received = received;
+        record.parameter = parameter;
+        record.response = response;
+        record.err = err;
+        record.startTicks = startTicks;
+        record.endTicks = endTicks;
+        record.sequence = ++traceSequence;
+        record.deviceId = deviceId;
+        record.mode = flowMode;
+        record.flow = flowDepth ? flowNumber : 0;
+        pfnAppTrace(pTraceContext, &record);
+    }
+}
+#endif
+
+/*
+ * Record the result of an exchange with the sensor.
+ *
+ * @param command the command code, or GT511_TRACE_DATA for a data packet
+ * @param parameter the command parameter, or the data packet length
+ * @param pParameter points at the response parameter, can be NULL
+ * @param err the result of the exchange
+ * @param startTicks the time the exchange started
+ *
+ * This is called once for each command or data packet sent to the
+ * sensor, and updates the statistics and the trace.
+ */
+static void
+CommandDone(uint16_t command, uint32_t parameter, uint32_t *pParameter,
+            GT511_Error_t err, uint32_t startTicks)
+{
+    uint32_t endTicks = GetTicks();
+#ifdef GT511_FAULT_INJECTION
+    FaultCommandDone(err);
+#endif
+#if GT511_ENABLE_STATS
+    UpdateCommandStats(command, err, endTicks - startTicks);
+#endif
+#if GT511_ENABLE_STANDBY
+    lastCommandTicks = endTicks;
+#endif
+#if GT511_ENABLE_TRACE
+    uint32_t response = ((err == GT511_ERR_NONE) && pParameter) ? *pParameter : 0;
+    TraceExchange(command, parameter, response, err, startTicks, endTicks, false);
+#else
+    (void)parameter;
+    (void)pParameter;
+#endif
+    (void)command;
+    (void)err;
+    (void)startTicks;
+    (void)endTicks;
+}
+
+#if GT511_ENABLE_TRACE && GT511_ENABLE_RUN_FLOWS
+/*
+ * Mark the start of a process such as enrollment, so that the commands
+ * issued until EndFlow() are tagged with the mode and flow number in
+ * the trace.
+ *
+ * @param mode the mode of the process
+ */
+static void
+BeginFlow(GT511_Mode_t mode)
+{
+    if (flowDepth++ == 0)
+    {
+        flowMode = mode;
+        ++flowNumber;
+    }
+}
+
+/*
+ * Mark the end of a process started with BeginFlow().
+ */
+static void
+EndFlow(void)
+{
+    if (--flowDepth == 0)
+    {
+        flowMode = GT511_MODE_IDLE;
+    }
+}
+#else
+#define BeginFlow(mode)
+#define EndFlow()
+#endif
+
+/*
+ * Issue a command and check response.
+ *
+ * @param command specific GT511 command code to send to reader
+ * @param pParameter points at storage for command and response parameter
+ *
+ * This is the entry point used for all commands.  It performs the command
+ * exchange with ExchangeCommand() and records the result.
+ *
+ * @return the result of ExchangeCommand().
+ */
+static GT511_Error_t
+IssueCommand(uint16_t command, uint32_t *pParameter)
+{
+    uint32_t parameter = (pParameter != NULL) ? *pParameter : 0;
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = ExchangeCommand(command, pParameter);
+    CommandDone(command, parameter, pParameter, err, startTicks);
+    return err;
+}
+
+#if GT511_ENABLE_INFO || GT511_ENABLE_TEMPLATE_IO || GT511_ENABLE_IMAGE_IO
+/*
+ * Record the result of receiving a data packet from the sensor.
+ *
+ * @param length the data packet length
+ * @param err the result of receiving the packet
+ * @param startTicks the time the receive started
+ *
+ * The packet is part of the command that asked for it, so it is not
+ * counted again in the command statistics, but it gets its own trace
+ * record.
+ */
+static void
+DataReceived(uint32_t length, GT511_Error_t err, uint32_t startTicks)
+{
+    uint32_t endTicks = GetTicks();
+#if GT511_ENABLE_STANDBY
+    lastCommandTicks = endTicks;
+#endif
+#if GT511_ENABLE_TRACE
+    TraceExchange(GT511_TRACE_DATA, length, 0, err, startTicks, endTicks, true);
+#else
+    (void)length;
+    (void)err;
+    (void)startTicks;
+#endif
+    (void)endTicks;
+}
+
+/*
+ * Receive and validate the header of a data packet from the sensor.
+ *
+ * @param pChecksum storage for the checksum of the header
+ *
+ * @return **GT511_ERR_NONE** if a valid header was received, or
+ * **GT511_ERR_OTHER_ERROR** if there was any problem.
+ */
+static GT511_Error_t
+ReceiveDataHeader(uint16_t *pChecksum)
+{
+    GT511_DataPacket_t header;
+    uint32_t count = ReceiveMessage((uint8_t *)&header, sizeof(header));
+    if ((count != sizeof(header))
+     || (header.start1 != 0x5A) || (header.start2 != 0xA5) || (header.id != deviceId))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    *pChecksum = Checksum((uint8_t *)&header, sizeof(header));
+    return GT511_ERR_NONE;
+}
+
+/*
+ * Receive and validate the checksum at the end of a data packet.
+ *
+ * @param computedChecksum the checksum computed over the header and payload
+ *
+ * @return **GT511_ERR_NONE** if the checksum matches, or
+ * **GT511_ERR_OTHER_ERROR** if there was any problem.
+ */
+static GT511_Error_t
+ReceiveDataChecksum(uint16_t computedChecksum)
+{
+    uint16_t checksum;
+    uint32_t count = ReceiveMessage((uint8_t *)&checksum, sizeof(checksum));
+    if ((count != sizeof(checksum)) || (checksum != computedChecksum))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+    return GT511_ERR_NONE;
+}
+
+/*
+ * Receive a data packet from the sensor.
+ *
+ * @param pData points at storage for the data packet payload
+ * @param length number of expected bytes in the payload
+ *
+ * The payload is received directly into the caller's storage, and the
+ * packet header and checksum are validated.  The storage is only used
+ * for the duration of the call.
+ *
+ * @return **GT511_ERR_NONE** if a valid data packet was received, or
+ * **GT511_ERR_OTHER_ERROR** if there was any problem.
+ */
+static GT511_Error_t
+ReceiveData(uint8_t *pData, uint32_t length)
+{
+    uint16_t checksum;
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = ReceiveDataHeader(&checksum);
+    if (err == GT511_ERR_NONE)
+    {
+        uint32_t count = ReceiveMessage(pData, length);
+        if (count == length)
+        {
+            checksum += Checksum(pData, length);
+            err = ReceiveDataChecksum(checksum);
+        }
+        else
+        {
+            err = GT511_ERR_OTHER_ERROR;
+        }
+    }
+    DataReceived(length, err, startTicks);
+    return err;
+}
+#endif
+
+#if GT511_ENABLE_TEMPLATE_IO
+// State of a template hash while it is computed, see HashInit()
+typedef struct
+{
+    uint32_t state[8];      // SHA-256 hash value so far
+    uint32_t count;         // number of bytes hashed
+    uint8_t block[64];      // bytes waiting for a full block
+} HashContext_t;
+
+// SHA-256 round constants
+static const uint32_t hashRoundK[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * Start a template hash.
+ *
+ * @param pCtx the hash state to set up
+ *
+ * The template hash is SHA-256, cut to the first GT511_HASH_SIZE bytes.
+ * It is computed a piece at a time so that it can be done while the
+ * template is received from the serial port.
+ */
+static void
+HashInit(HashContext_t *pCtx)
+{
+    static const uint32_t initial[8] =
+    {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+        0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+    memcpy(pCtx->state, initial, sizeof(initial));
+    pCtx->count = 0;
+}
+
+/*
+ * Add one 64 byte block to a template hash.
+ *
+ * @param pCtx the hash state
+ *
+ * The message schedule is kept as a rolling window of 16 words, so that
+ * little stack is needed.
+ */
+static void
+HashBlock(HashContext_t *pCtx)
+{
+    uint32_t w[16];
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        const uint8_t *p = &pCtx->block[i * 4];
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+             | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    uint32_t a = pCtx->state[0];
+    uint32_t b = pCtx->state[1];
+    uint32_t c = pCtx->state[2];
+    uint32_t d = pCtx->state[3];
+    uint32_t e = pCtx->state[4];
+    uint32_t f = pCtx->state[5];
+    uint32_t g = pCtx->state[6];
+    uint32_t h = pCtx->state[7];
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            uint32_t w15 = w[(i - 15) & 15];
+            uint32_t w2 = w[(i - 2) & 15];
+            uint32_t s0 = ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);
+            uint32_t s1 = ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);
+            w[i & 15] += s0 + w[(i - 7) & 15] + s1;
+        }
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25))
+                    + ((e & f) ^ (~e & g)) + hashRoundK[i] + w[i & 15];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22))
+                    + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    pCtx->state[0] += a;
+    pCtx->state[1] += b;
+    pCtx->state[2] += c;
+    pCtx->state[3] += d;
+    pCtx->state[4] += e;
+    pCtx->state[5] += f;
+    pCtx->state[6] += g;
+    pCtx->state[7] += h;
+}
+
+/*
+ * Add more template data to a template hash.
+ *
+ * @param pCtx the hash state
+ * @param pData points at the next data to add to the hash
+ * @param length number of bytes of data
+ */
+static void
+HashUpdate(HashContext_t *pCtx, const uint8_t *pData, uint32_t length)
+{
+    while (length--)
+    {
+        pCtx->block[pCtx->count++ % 64] = *pData++;
+        if ((pCtx->count % 64) == 0)
+        {
+            HashBlock(pCtx);
+        }
+    }
+}
+
+/*
+ * Finish a template hash.
+ *
+ * @param pCtx the hash state
+ * @param pHash storage for the hash
+ */
+static void
+HashFinal(HashContext_t *pCtx, GT511_Hash_t *pHash)
+{
+    // pad with a 1 bit and zeros, and end with the length in bits
+    uint64_t bits = (uint64_t)pCtx->count * 8;
+    uint32_t used = pCtx->count % 64;
+    pCtx->block[used++] = 0x80;
+    if (used > 56)
+    {
+        memset(&pCtx->block[used], 0, 64 - used);
+        HashBlock(pCtx);
+        used = 0;
+    }
+    memset(&pCtx->block[used], 0, 56 - used);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        pCtx->block[63 - i] = (uint8_t)(bits >> (i * 8));
+    }
+    HashBlock(pCtx);
+
+    for (uint32_t i = 0; i < GT511_HASH_SIZE; i++)
+    {
+        pHash->bytes[i] = (uint8_t)(pCtx->state[i / 4] >> (24 - ((i % 4) * 8)));
+    }
+}
+
+/*
+ * Receive a template data packet in pieces.
+ *
+ * @param pfnWrite function to pass each piece of the template to, or NULL
+ * @param pContext application context passed to _pfnWrite_
+ * @param pHash storage for the hash of the template
+ *
+ * The template is received in small pieces so that no storage is needed
+ * for the whole template.  Each piece is passed to _pfnWrite_ and added
+ * to the template hash.  The packet checksum is still validated at the
+ * end, so the application must not rely on the pieces until this
+ * function returns successfully.  If _pfnWrite_ returns false then it is
+ * not called again, but the rest of the packet is still read and
+ * discarded so that it cannot be mistaken for the next response.
+ *
+ * @return **GT511_ERR_NONE** if a valid data packet was received, or
+ * **GT511_ERR_OTHER_ERROR** if there was any problem.
+ */
+static GT511_Error_t
+ReceiveDataStream(GT511_WriteData_t pfnWrite, void *pContext, GT511_Hash_t *pHash)
+{
+    uint16_t checksum;
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = ReceiveDataHeader(&checksum);
+    HashContext_t hash;
+    HashInit(&hash);
+    uint8_t chunk[GT511_STREAM_CHUNK_SIZE];
+    uint32_t remaining = GT511_TEMPLATE_SIZE;
+    bool aborted = false;
+    while ((err == GT511_ERR_NONE) && remaining)
+    {
+        uint32_t length = (remaining < sizeof(chunk)) ? remaining : sizeof(chunk);
+        uint32_t count = ReceiveMessage(chunk, length);
+        if (count != length)
+        {
+            err = GT511_ERR_OTHER_ERROR;
+            break;
+        }
+        checksum += Checksum(chunk, length);
+        HashUpdate(&hash, chunk, length);
+        if (!aborted && pfnWrite && !pfnWrite(pContext, chunk, length))
+        {
+            aborted = true;
+        }
+        remaining -= length;
+    }
+
+    // the checksum is always read so the link stays in step
+    if (err == GT511_ERR_NONE)
+    {
+        err = ReceiveDataChecksum(checksum);
+    }
+    DataReceived(GT511_TEMPLATE_SIZE, err, startTicks);
+    if (aborted)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+    if (err == GT511_ERR_NONE)
+    {
+        HashFinal(&hash, pHash);
+    }
+    return err;
+}
+
+/*
+ * Send a template data packet in pieces and check response.
+ *
+ * @param pfnRead function to get each piece of the template from
+ * @param pContext application context passed to _pfnRead_
+ * @param pHash storage for the hash of the template
+ *
+ * The template is sent in small pieces as they are provided by
+ * _pfnRead_, so that no storage is needed for the whole template.
+ *
+ * @return **GT511_ERR_NONE** if the data was sent and a correct
+ * response was received with an ACK.  If the response contains a NACK
+ * then the response error code is returned.  If any other error occurs
+ * then **GT511_ERR_OTHER_ERROR** is returned.
+ */
+static GT511_Error_t
+IssueDataStream(GT511_ReadData_t pfnRead, void *pContext, GT511_Hash_t *pHash)
+{
+    GT511_DataPacket_t header;
+    header.start1 = 0x5A;
+    header.start2 = 0xA5;
+    header.id = deviceId;
+    uint16_t checksum = Checksum((uint8_t *)&header, sizeof(header));
+
+    GT511_Error_t err = GT511_ERR_OTHER_ERROR;
+    uint32_t startTicks = GetTicks();
+    bool ok = GT511_SendMessage((uint8_t *)&header, sizeof(header));
+    HashContext_t hash;
+    HashInit(&hash);
+    uint8_t chunk[GT511_STREAM_CHUNK_SIZE];
+    uint32_t remaining = GT511_TEMPLATE_SIZE;
+    bool aborted = false;
+    while (ok && remaining)
+    {
+        // once the application stops providing the template, send
+        // filler so the sensor still gets a packet of the right length
+        uint32_t length = (remaining < sizeof(chunk)) ? remaining : sizeof(chunk);
+        if (!aborted && !pfnRead(pContext, chunk, length))
+        {
+            aborted = true;
+        }
+        if (aborted)
+        {
+            memset(chunk, 0, length);
+        }
+        ok = GT511_SendMessage(chunk, length);
+        checksum += Checksum(chunk, length);
+        HashUpdate(&hash, chunk, length);
+        remaining -= length;
+    }
+
+    // a wrong checksum makes the sensor reject an abandoned template
+    if (aborted)
+    {
+        checksum = ~checksum;
+    }
+    if (ok && GT511_SendMessage((uint8_t *)&checksum, sizeof(checksum)))
+    {
+        err = ReceiveAck(NULL);
+        if (aborted)
+        {
+            err = GT511_ERR_OTHER_ERROR;
+        }
+    }
+    CommandDone(GT511_TRACE_DATA, GT511_TEMPLATE_SIZE, NULL, err, startTicks);
+
+    HashFinal(&hash, pHash);
+    return err;
+}
+
+/*
+ * Forget the saved template hash for an ID, because the enrolled
+ * fingerprint at that ID has changed or been deleted.
+ *
+ * @param id the index ID.  IDs out of range are ignored.
+ */
+static void
+ForgetTemplateHash(uint32_t id)
+{
+    if (id < GT511_NUM_SLOTS)
+    {
+        templateHashValid[id / 32] &= ~(1UL << (id % 32));
+    }
+}
+
+/*
+ * Save the hash of the template enrolled at an ID.
+ *
+ * @param id the index ID.  IDs out of range are ignored.
+ * @param pHash the hash of the template
+ */
+static void
+SaveTemplateHash(uint32_t id, const GT511_Hash_t *pHash)
+{
+    if (id < GT511_NUM_SLOTS)
+    {
+        templateHash[id] = *pHash;
+        templateHashValid[id / 32] |= 1UL << (id % 32);
+    }
+}
+#endif
+
+/*
+ * Forget everything the driver has saved about an ID, because the
+ * enrolled fingerprint at that ID has changed or been deleted.
+ *
+ * @param id the index ID.  IDs out of range are ignored.
+ */
+static void
+ForgetID(uint32_t id)
+{
+#if GT511_ENABLE_TEMPLATE_IO
+    ForgetTemplateHash(id);
+#endif
+#if GT511_ENABLE_RUN_FLOWS
+    if (id < GT511_NUM_SLOTS)
+    {
+        preferHighQuality[id / 32] &= ~(1UL << (id % 32));
+    }
+#else
+    (void)id;
+#endif
+}
+
+/*
+ * Forget everything the driver has saved about all IDs, because the
+ * sensor database has been cleared or a different sensor is in use.
+ */
+static void
+ForgetAllIDs(void)
+{
+#if GT511_ENABLE_TEMPLATE_IO
+    memset(templateHashValid, 0, sizeof(templateHashValid));
+#endif
+#if GT511_ENABLE_RUN_FLOWS
+    memset(preferHighQuality, 0, sizeof(preferHighQuality));
+#endif
+}
+
+#if GT511_ENABLE_TEMPLATE_IO
+/*
+ * Send a data packet to the sensor.
+ *
+ * @param pData points at the data packet payload
+ * @param length number of bytes in the payload
+ *
+ * The payload is sent directly from the caller's storage, wrapped with
+ * the packet header and checksum.  The response is not read.
+ *
+ * @return **true** if the packet was sent.
+ */
+static bool
+SendData(uint8_t *pData, uint32_t length)
+{
+    GT511_DataPacket_t header;
+    header.start1 = 0x5A;
+    header.start2 = 0xA5;
+    header.id = deviceId;
+    uint16_t checksum = Checksum((uint8_t *)&header, sizeof(header))
+                      + Checksum(pData, length);
+
+    return GT511_SendMessage((uint8_t *)&header, sizeof(header))
+        && GT511_SendMessage(pData, length)
+        && GT511_SendMessage((uint8_t *)&checksum, sizeof(checksum));
+}
+
+/*
+ * Send a data packet to the sensor and check response.
+ *
+ * @param pData points at the data packet payload
+ * @param length number of bytes in the payload
+ * @param pParameter points at storage for the response parameter
+ *
+ * The payload is sent with SendData().  The sensor then replies with a
+ * response packet in the same way as for a command.  The response
+ * parameter is returned through _pParameter_, which can be NULL.
+ *
+ * @return **GT511_ERR_NONE** if the data was sent and a correct
+ * response was received with an ACK.  If the response contains a NACK
+ * then the response error code is returned.  If any other error occurs
+ * then **GT511_ERR_OTHER_ERROR** is returned.
+ */
+static GT511_Error_t
+IssueData(uint8_t *pData, uint32_t length, uint32_t *pParameter)
+{
+    GT511_Error_t err = GT511_ERR_OTHER_ERROR;
+    uint32_t startTicks = GetTicks();
+    if (SendData(pData, length))
+    {
+        err = ReceiveAck(pParameter);
+    }
+    CommandDone(GT511_TRACE_DATA, length, pParameter, err, startTicks);
+    return err;
+}
+#endif
+
+#if GT511_ENABLE_RUN_FLOWS
+/*
+ * Check for expiration of a wait for a press or release.
+ *
+ * @param mode the current mode of the driver
+ * @param startTicks the time when the wait started
+ *
+ * The wait expires when either the application timeout from
+ * GT511_CheckTimeout() or the driver timeout for the mode expires.
+ *
+ * @return **true** if the wait has timed out.
+ */
+static bool
+WaitExpired(GT511_Mode_t mode, uint32_t startTicks)
+{
+    if (GT511_CheckTimeout(mode))
+    {
+        return true;
+    }
+    return waitTimeout[mode] && ((GetTicks() - startTicks) >= waitTimeout[mode]);
+}
+
+/*
+ * Wait until the next poll of the sensor.
+ *
+ * @param mode the current mode of the driver
+ * @param startTicks the time when the wait for press or release started
+ *
+ * Polls are aligned to multiples of the poll interval on the application
+ * clock rather than spaced from the previous poll.  When several drivers
+ * or sensors share one clock their poll wakeups then fall on the same
+ * ticks and can be serviced together.  The sleep is cut short if the
+ * driver wait timeout expires first.  This does nothing if there is no
+ * poll interval or sleep function.
+ */
+static void
+PollDelay(GT511_Mode_t mode, uint32_t startTicks)
+{
+    if (pfnAppSleep && pollInterval)
+    {
+        uint32_t now = GetTicks();
+        uint32_t ticks = pollInterval - (now % pollInterval);
+        if (waitTimeout[mode])
+        {
+            uint32_t elapsed = now - startTicks;
+            uint32_t remaining = (elapsed < waitTimeout[mode])
+                               ? (waitTimeout[mode] - elapsed) : 0;
+            ticks = (remaining < ticks) ? remaining : ticks;
+        }
+        pfnAppSleep(ticks);
+    }
+}
+
+/*
+ * Add a sensor poll to a press/release confirmation history.
+ *
+ * @param pHistory points at the history of recent polls, one bit per poll
+ * @param pDebounce the confirmation settings to apply
+ * @param agree **true** if this poll agrees with the awaited state
+ *
+ * The most recent poll is kept in bit 0 of the history.  The awaited
+ * state is confirmed when enough polls within the window agree and the
+ * most recent polls agree for at least the dwell count.
+ *
+ * @return **true** if the awaited state is now confirmed.
+ */
+static bool
+DebounceUpdate(uint32_t *pHistory, const GT511_Debounce_t *pDebounce, bool agree)
+{
+    uint32_t history = (*pHistory << 1) | (agree ? 1 : 0);
+    *pHistory = history;
+
+    // count the agreeing polls within the window
+    uint32_t agreeCount = 0;
+    for (uint32_t i = 0; i < pDebounce->windowCount; i++)
+    {
+        agreeCount += (history >> i) & 1;
+    }
+
+    // the most recent polls must all agree for the dwell count
+    uint32_t dwellMask = (pDebounce->dwellCount >= 32) ? 0xFFFFFFFFUL
+                       : (1UL << pDebounce->dwellCount) - 1;
+    bool dwellOk = (history & dwellMask) == dwellMask;
+
+    return dwellOk && (agreeCount >= pDebounce->confirmCount);
+}
+
+/*
+ * Capture a fingerprint and record the result in the mode statistics.
+ *
+ * @param mode the current mode of the driver (identify, enroll, etc)
+ * @param highQuality **true** to use a high quality capture
+ *
+ * @return the result of GT511_CaptureFinger().
+ */
+static GT511_Error_t
+CaptureFinger(GT511_Mode_t mode, bool highQuality)
+{
+#if GT511_ENABLE_STATS
+    uint32_t startTicks = GetTicks();
+#endif
+    GT511_Error_t err = GT511_CaptureFinger(highQuality);
+#if GT511_ENABLE_STATS
+    uint32_t ticks = GetTicks() - startTicks;
+    ++pressStats[mode].captureCount;
+    pressStats[mode].captureTicks += ticks;
+    if (highQuality)
+    {
+        ++pressStats[mode].highQualityCount;
+        pressStats[mode].highQualityTicks += ticks;
+    }
+    if (err != GT511_ERR_NONE)
+    {
+        ++pressStats[mode].captureFailCount;
+    }
+#else
+    (void)mode;
+#endif
+    return err;
+}
+
+/*
+ * Capture a fingerprint and match it, escalating to a high quality
+ * capture if needed.
+ *
+ * @param mode the current mode of the driver, identify or verify
+ * @param pId points at the ID to verify, or storage for the ID identified
+ * @param pCaptured storage for whether the last capture succeeded
+ *
+ * A fast capture is tried first, unless the last match was rejected or
+ * the ID to verify has needed a high quality capture before.  If the fast
+ * capture is a bad fingerprint then the finger is captured again at high
+ * quality while it is still on the sensor.  A rejected match is not
+ * retried, so each presentation gets only one match, but the next
+ * attempt starts at high quality.  IDs that only match after escalation
+ * are remembered so that the next verify of that ID goes straight to
+ * high quality.
+ *
+ * @return the result of the last capture or match.
+ */
+static GT511_Error_t
+CaptureAndMatch(GT511_Mode_t mode, uint32_t *pId, bool *pCaptured)
+{
+    bool escalated = captureEscalation && escalateNext;
+    bool highQuality = escalated;
+    if ((mode == GT511_MODE_VERIFY) && (*pId < GT511_NUM_SLOTS))
+    {
+        highQuality |= (preferHighQuality[*pId / 32] & (1UL << (*pId % 32))) != 0;
+    }
+#if GT511_ENABLE_STATS
+    if (escalated)
+    {
+        ++pressStats[mode].escalationCount;
+    }
+#endif
+
+    GT511_Error_t err = CaptureFinger(mode, highQuality);
+    if ((err == GT511_ERR_BAD_FINGER) && captureEscalation && !highQuality)
+    {
+        highQuality = true;
+        escalated = true;
+#if GT511_ENABLE_STATS
+        ++pressStats[mode].escalationCount;
+#endif
+        err = CaptureFinger(mode, highQuality);
+    }
+    *pCaptured = (err == GT511_ERR_NONE);
+    if (!*pCaptured)
+    {
+        return err;
+    }
+
+    err = (mode == GT511_MODE_VERIFY) ? GT511_Verify(*pId)
+                                      : GT511_Identify(pId);
+#if GT511_ENABLE_STATS
+    ++pressStats[mode].matchCount;
+    if (err != GT511_ERR_NONE)
+    {
+        ++pressStats[mode].rejectCount;
+    }
+#endif
+
+    escalateNext = (err == GT511_ERR_IDENTIFY_FAILED) || (err == GT511_ERR_VERIFY_FAILED);
+    if ((err == GT511_ERR_NONE) && escalated && (*pId < GT511_NUM_SLOTS))
+    {
+        preferHighQuality[*pId / 32] |= 1UL << (*pId % 32);
+    }
+    return err;
+}
+
+/*
+ * Deliver an event to the application.
+ *
+ * @param mode the current mode of the driver (identify, enroll, etc)
+ * @param ui the user event or notification
+ * @param id the ID that the event is about, or GT511_ID_NONE
+ *
+ * If the event queue is enabled the event is placed in the queue,
+ * otherwise GT511_UserCallback() is called.  This never waits for the
+ * application to take events from the queue.  The ID is only passed on
+ * through the queue.
+ */
+static void
+PostEvent(GT511_Mode_t mode, GT511_UserInfo_t ui, uint32_t id)
+{
+#if GT511_ENABLE_EVENT_QUEUE
+    if (eventQueueEnabled)
+    {
+        uint32_t head = eventHead;
+        uint32_t used = head - eventTail;
+        if (used < GT511_EVENT_QUEUE_SIZE)
+        {
+            GT511_Event_t *pEvent = &eventQueue[head % GT511_EVENT_QUEUE_SIZE];
+            pEvent->mode = mode;
+            pEvent->ui = ui;
+            pEvent->id = id;
+            pEvent->deviceId = deviceId;
+            pEvent->postTicks = GetTicks();
+            EventBarrier();
+            eventHead = head + 1;
+
+            ++eventStats.postedCount;
+            if (used + 1 > eventStats.highWater)
+            {
+                eventStats.highWater = used + 1;
+            }
+            return;
+        }
+
+        ++eventStats.overflowCount;
+        if (eventOverflow == GT511_OVERFLOW_DROP)
+        {
+            return;
+        }
+    }
+#else
+    (void)id;
+#endif
+    GT511_UserCallback(mode, ui);
+}
+
+/*
+ * Wait for user to touch finger to sensor.
+ *
+ * @param mode the current mode of the driver (identify, enroll, etc)
+ *
+ * This function will use the GT511_UserCallback() to prompt the user
+ * to press the sensor, and to then wait for the user to press the
+ * sensor.  At the start GT511_SetTimeout() will be called to allow the
+ * application set a timeout if needed.  While waiting then
+ * GT511_CheckTimeout() will be repeatedly called to see if a timeout
+ * occurs.  The driver timeout set by GT511_SetWaitTimeout() is also
+ * checked.  This function will wait until either it correctly detects a
+ * finger touch, or the timeout occurs, or some other error happens.
+ * The touch must be confirmed according to the debounce settings for
+ * the mode (see GT511_SetDebounce()).
+ *
+ * @return **GT511_ERR_NONE** if a touch was detected.  If the timeout
+ * happens then it will return **GT511_ERR_OTHER_ERROR**.  If any other
+ * error occurs then that code will be returned.  The function was not
+ * successful at detecting a touch if anything other than GT511_ERR_NONE
+ * is returned.
+ */
+static GT511_Error_t
+WaitFingerPress(GT511_Mode_t mode)
+{
+    GT511_Error_t err;
+    // wait for a finger press
+    PostEvent(mode, GT511_UI_PRESS, GT511_ID_NONE);
+    ConsolePrintf("waiting for touch\n");
+    bool isPressed = false;
+    bool confirmed = false;
+    uint32_t history = 0;
+#if GT511_ENABLE_STATS
+    uint32_t pollsSinceTouch = 0;
+    uint32_t touchTicks = 0;
+#endif
+    GT511_SetTimeout(mode);
+    uint32_t startTicks = GetTicks();
+    do
+    {
+        // check for timeout from app or driver
+        bool timeout = WaitExpired(mode, startTicks);
+        if (timeout)
+        {
+            ConsolePrintf("touch wait timeout\n");
+            PostEvent(mode, GT511_UI_TIMEOUT, GT511_ID_NONE);
+            return GT511_ERR_OTHER_ERROR;
+        }
+
+        // check for finger press
+        err = GT511_IsPressFinger(&isPressed);
+        if (err != GT511_ERR_NONE)
+        {
+            GT511_CmosLed(false);
+            ConsolePrintf("error checking for finger press: %s\n",
+                          GT511_ErrorString(err));
+            PostEvent(mode, GT511_UI_ERROR, GT511_ID_NONE);
+            return err;
+        }
+
+        confirmed = DebounceUpdate(&history, &debounce[mode], isPressed);
+#if GT511_ENABLE_STATS
+        // count the polls spent confirming the touch that is still in the
+        // window, starting again once an earlier touch drops out of it
+        uint32_t window = debounce[mode].windowCount;
+        uint32_t windowMask = (window >= 32) ? 0xFFFFFFFFUL : (1UL << window) - 1;
+        if (history & windowMask)
+        {
+            if (pollsSinceTouch == 0)
+            {
+                touchTicks = GetTicks();
+            }
+            ++pollsSinceTouch;
+        }
+        else
+        {
+            pollsSinceTouch = 0;
+            touchTicks = 0;
+        }
+#endif
+        if (!confirmed)
+        {
+            PollDelay(mode, startTicks);
+        }
+    } while (!confirmed);
+
+#if GT511_ENABLE_STATS
+    ++pressStats[mode].pressCount;
+    pressStats[mode].extraPolls += pollsSinceTouch - 1;
+    pressStats[mode].extraTicks += GetTicks() - touchTicks;
+#endif
+    ConsolePrintf("touch detected\n");
+    return err;
+}
+
+/*
+ * Wait for user to release sensor touch.
+ *
+ * @param mode the current mode of the driver (identify, enroll, etc)
+ *
+ * This function will use the GT511_UserCallback() to prompt the user
+ * to release the sensor, and to then wait for the user to release the
+ * sensor.  At the start GT511_SetTimeout() will be called to allow the
+ * application set a timeout if needed.  While waiting then
+ * GT511_CheckTimeout() will be repeatedly called to see if a timeout
+ * occurs.  The driver timeout set by GT511_SetWaitTimeout() is also
+ * checked.  This function will wait until either it correctly detects the
+ * touch has been released, or the timeout occurs, or some other error happens.
+ * The release must be confirmed according to the debounce settings for
+ * the mode (see GT511_SetDebounce()).
+ *
+ * @return **GT511_ERR_NONE** if the touch was released.  If the timeout
+ * happens then it will return **GT511_ERR_OTHER_ERROR**.  If any other
+ * error occurs then that code will be returned.  The function was not
+ * successful at detecting a release if anything other than GT511_ERR_NONE
+ * is returned.
+ */
+static GT511_Error_t
+WaitFingerRelease(GT511_Mode_t mode)
+{
+    GT511_Error_t err;
+    // wait for a finger release
+    PostEvent(mode, GT511_UI_RELEASE, GT511_ID_NONE);
+    ConsolePrintf("waiting for release\n");
+    bool isPressed = true;
+    bool confirmed = false;
+    uint32_t history = 0;
+    GT511_SetTimeout(mode);
+    uint32_t startTicks = GetTicks();
+    do
+    {
+        // check for timeout from app or driver
+        bool timeout = WaitExpired(mode, startTicks);
+        if (timeout)
+        {
+            ConsolePrintf("release wait timeout\n");
+            PostEvent(mode, GT511_UI_TIMEOUT, GT511_ID_NONE);
+            return GT511_ERR_OTHER_ERROR;
+        }
+
+        // check for finger press
+        err = GT511_IsPressFinger(&isPressed);
+        if (err != GT511_ERR_NONE)
+        {
+            GT511_CmosLed(false);
+            ConsolePrintf("error checking for finger press: %s\n",
+                          GT511_ErrorString(err));
+            PostEvent(mode, GT511_UI_ERROR, GT511_ID_NONE);
+            return err;
+        }
+        confirmed = DebounceUpdate(&history, &debounce[mode], !isPressed);
+        if (!confirmed)
+        {
+            PollDelay(mode, startTicks);
+        }
+    } while (!confirmed);
+
+    ConsolePrintf("release detected\n");
+    return err;
+}
+
+#endif
+
+#if GT511_ENABLE_ERROR_STRINGS
+// Define a table to map error codes to human readable strings
+typedef struct
+{
+    GT511_Error_t errCode;
+    const char *errString;
+} ErrorStringTable_t;
+
+static const ErrorStringTable_t errorStringTable[] =
+{
+    { GT511_ERR_NONE, "NONE" },
+    { GT511_ERR_TIMEOUT, "TIMEOUT" },
+    { GT511_ERR_INVALID_BAUDRATE, "INVALID_BAUDRATE" },
+    { GT511_ERR_INVALID_POS, "INVALID_POS" },
+    { GT511_ERR_IS_NOT_USED, "IS_NOT_USED" },
+    { GT511_ERR_IS_ALREADY_USED, "IS_ALREADY_USED" },
+    { GT511_ERR_COMM_ERR, "COMM_ERR" },
+    { GT511_ERR_VERIFY_FAILED, "VERIFY_FAILED" },
+    { GT511_ERR_IDENTIFY_FAILED, "IDENTIFY_FAILED" },
+    { GT511_ERR_DB_IS_FULL, "DB_IS_FULL" },
+    { GT511_ERR_DB_IS_EMPTY, "DB_IS_EMPTY" },
+    { GT511_ERR_TURN_ERR, "TURN_ERR" },
+    { GT511_ERR_BAD_FINGER, "BAD_FINGER" },
+    { GT511_ERR_ENROLL_FAILED, "ENROLL_FAILED" },
+    { GT511_ERR_IS_NOT_SUPPORTED, "IS_NOT_SUPPORTED" },
+    { GT511_ERR_DEV_ERR, "DEV_ERR" },
+    { GT511_ERR_CAPTURE_CANCELED, "CAPTURE_CANCELED" },
+    { GT511_ERR_INVALID_PARAM, "INVALID_PARAM" },
+    { GT511_ERR_FINGER_IS_NOT_PRESSED, "FINGER_IS_NOT_PRESSED" },
+    { GT511_ERR_OTHER_ERROR, "OTHER_ERROR" },
+};
+#define NUM_ERR_STRINGS (sizeof(errorStringTable) / sizeof(ErrorStringTable_t))
+#endif
+
+/******************************************************************************
+ * Public API
+ *****************************************************************************/
+
+/**
+ * Return string representation of error code.
+ *
+ * @param err the error code to check
+ *
+ * This can be used for debugging to print a string name of the error code.
+ * If GT511_ENABLE_ERROR_STRINGS is not set then the strings are left out
+ * of the build to save space, and "UNKNOWN" is always returned.
+ *
+ * @return A string representation of the error code.  If the error code
+ * does not match any known value then "UNKNOWN" is returned.
+ */
+const char *
+GT511_ErrorString(GT511_Error_t err)
+{
+#if GT511_ENABLE_ERROR_STRINGS
+    for (uint32_t i = 0; i < NUM_ERR_STRINGS; i++)
+    {
+        if (errorStringTable[i].errCode == err)
+        {
+            return errorStringTable[i].errString;
+        }
+    }
+#else
+    (void)err;
+#endif
+    return "UNKNOWN";
+}
+
+/**
+ * Open the fingerprint reader for operation.
+ *
+ * @param pInfo optional pointer for retrieving sensor info
+ *
+ * The _pInfo_ parameter is optional and can be NULL.  If not NULL, then
+ * it will be populated with the information returned from the sensor.
+ * Retrieving the info requires GT511_ENABLE_INFO.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.  If info was requested
+ * but GT511_ENABLE_INFO is not set then **GT511_ERR_IS_NOT_SUPPORTED** is
+ * returned without opening the sensor.
+ */
+GT511_Error_t
+GT511_Open(GT511_Info_t *pInfo)
+{
+#if !GT511_ENABLE_INFO
+    if (pInfo)
+    {
+        return GT511_ERR_IS_NOT_SUPPORTED;
+    }
+#endif
+    uint32_t parm = pInfo ? 1 : 0;
+
+    // Send the command and check response
+    GT511_Error_t err = IssueCommand(GT511_CMD_OPEN, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+#if GT511_ENABLE_INFO
+    // If user asked for extra info, collect the info data which should
+    // be forthcoming
+    if (pInfo)
+    {
+        // Receive a data packet containing the extra info directly
+        // into the callers storage
+        err = ReceiveData((uint8_t *)pInfo, sizeof(GT511_Info_t));
+        if (err != GT511_ERR_NONE)
+        {
+            return err;
+        }
+    }
+#endif
+
+    // If we got this far then there are no errors.
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Close the fingerprint reader for operation.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_Close(void)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_CLOSE, NULL);
+    pressCacheValid = false;
+    return err;
+}
+
+/**
+ * Control the LED backlight.
+ *
+ * @param on set to **true** to turn on the backlight, or **false** for off
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_CmosLed(bool on)
+{
+    uint32_t parm = on ? 1 : 0;
+    GT511_Error_t err = IssueCommand(GT511_CMD_CMOS_LED, &parm);
+    if (err == GT511_ERR_NONE)
+    {
+        ledOn = on;
+#if GT511_ENABLE_STANDBY
+        // the LED is set deliberately, so an LED state saved by a standby
+        // that did not complete no longer applies
+        if (!inStandby)
+        {
+            standbyLedOn = false;
+        }
+#endif
+    }
+
+    // the sensor cannot detect a finger with the backlight off, so any
+    // saved press state no longer applies
+    pressCacheValid = false;
+    return err;
+}
+
+/**
+ * Check to see if a finger is pressed
+ *
+ * @param pIsPressed storage for returned value
+ *
+ * The parameter *pIsPressed* points at a flag to contain the returned
+ * value.  It will be set to **true** if a finger press is detected, or
+ * **false** if no finger press is detected.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_IsPressFinger(bool *pIsPressed)
+{
+    uint32_t parm = 0;
+    GT511_Error_t err = IssueCommand(GT511_CMD_IS_PRESS_FINGER, &parm);
+
+    // return requested flag
+    // this will have no meaning if err != _NONE
+    if (pIsPressed != NULL)
+    {
+        // return parameter is 0 if pressed, so we need to NOT it
+        *pIsPressed = !parm;
+    }
+
+    // save the state for GT511_IsPressFingerCached()
+    pressCacheValid = (err == GT511_ERR_NONE);
+    pressCacheState = !parm;
+    pressCacheTicks = GetTicks();
+
+    return err;
+}
+
+/**
+ * Check to see if a finger is pressed, using a recent result if possible
+ *
+ * @param pIsPressed storage for returned value
+ * @param maxAge the oldest result to accept, in clock ticks
+ *
+ * This works like GT511_IsPressFinger() except that if the sensor was
+ * polled within the last _maxAge_ clock ticks, by this function or by
+ * the driver while waiting for a press, then that result is returned
+ * without another command to the sensor.  This saves a command exchange
+ * for applications that check the press state frequently.  A clock must
+ * be provided with GT511_SetClock(), otherwise the sensor is always
+ * polled.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_IsPressFingerCached(bool *pIsPressed, uint32_t maxAge)
+{
+    if (pressCacheValid && pfnAppGetTicks
+     && ((GetTicks() - pressCacheTicks) <= maxAge))
+    {
+        if (pIsPressed != NULL)
+        {
+            *pIsPressed = pressCacheState;
+        }
+        return GT511_ERR_NONE;
+    }
+
+    return GT511_IsPressFinger(pIsPressed);
+}
+
+/**
+ * Capture a finger print.
+ *
+ * @param highQuality **true** to use a high quality capture
+ *
+ * According to the sensor data sheet, a high quality capture should be
+ * used for enrollment while a normal capture used for identification.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_CaptureFinger(bool highQuality)
+{
+    uint32_t parm = highQuality ? 1 : 0;
+    GT511_Error_t err = IssueCommand(GT511_CMD_CAPTURE_FINGER, &parm);
+    return err;
+}
+
+/**
+ * Identify a fingerprint
+ *
+ * @param pId pointer to the ID value of the identified fingerprint
+ *
+ * If a captured fingerprint is successfully identified, then the index ID
+ * of the fingerprint will be stored at _*pId_.  You must check the function
+ * return value to make sure that the returned ID value is valid.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_Identify(uint32_t *pId)
+{
+    uint32_t parm = 0;
+    GT511_Error_t err = IssueCommand(GT511_CMD_IDENTIFY, &parm);
+
+    // Read id from response parameter.  Not meaningful if err != _NONE
+    if (pId != NULL)
+    {
+        *pId = parm;
+    }
+
+    return err;
+}
+
+/**
+ * Start enrollment
+ *
+ * @param id index ID to use for fingerprint enrollment
+ *
+ * This will start the enrollment process, using the specified ID index
+ * to store the enrolled fingerprint.  This will not work if there is
+ * already a fingerprint enrolled at that index.  You can use
+ * GT511_CheckEnrolled() to make sure the index is available.
+ *
+ * @note Please see the sensor data sheet to understand the enrollment process.
+ * There are several steps.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_EnrollStart(uint32_t id)
+{
+    uint32_t parm = id;
+    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL_START, &parm);
+    ForgetID(id);
+    return err;
+}
+
+/**
+ * Enroll step 1
+ *
+ * Enroll a captured fingerprint, first step.
+ *
+ * @note Please see the sensor data sheet to understand the enrollment process.
+ * There are several steps.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_Enroll1(void)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL1, NULL);
+    return err;
+}
+
+/**
+ * Enroll step 2
+ *
+ * Enroll a captured fingerprint, second step.
+ *
+ * @note Please see the sensor data sheet to understand the enrollment process.
+ * There are several steps.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_Enroll2(void)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL2, NULL);
+    return err;
+}
+
+/**
+ * Enroll step 3
+ *
+ * Enroll a captured fingerprint, third and final step.
+ *
+ * @note Please see the sensor data sheet to understand the enrollment process.
+ * There are several steps.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_Enroll3(void)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL3, NULL);
+    return err;
+}
+
+/**
+ * Delete all enrolled IDs
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_DeleteAll(void)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_DELETE_ALL, NULL);
+    ForgetAllIDs();
+    return err;
+}
+
+/**
+ * Delete specific enrolled ID
+ *
+ * @param id index of ID to delete
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_DeleteID(uint32_t id)
+{
+    uint32_t parm = id;
+    GT511_Error_t err = IssueCommand(GT511_CMD_DELETE_ID, &parm);
+    ForgetID(id);
+    return err;
+}
+
+/**
+ * Revoke an enrolled ID and confirm that it is gone
+ *
+ * @param id index of ID to revoke
+ * @param pTicks optional storage for the time taken, in clock ticks
+ *
+ * This deletes the ID and then checks with the sensor that it is no
+ * longer enrolled.  If there is a communication error, or the ID is
+ * still enrolled, then the delete is tried again, up to
+ * GT511_REVOKE_ATTEMPTS times.
+ * The time from the start until the delete was confirmed is returned
+ * through _pTicks_ if it is not NULL, which requires a clock provided
+ * by GT511_SetClock().  An ID that was not enrolled is treated as
+ * already revoked.  When revoking a person at several readers the
+ * application calls this for each reader and raises an alarm for any
+ * reader that does not return **GT511_ERR_NONE** in time.
+ *
+ * @return **GT511_ERR_NONE** if the sensor confirmed the ID is no longer
+ * enrolled.  Otherwise the error from the last attempt is returned.
+ */
+GT511_Error_t
+GT511_RevokeID(uint32_t id, uint32_t *pTicks)
+{
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = GT511_ERR_OTHER_ERROR;
+
+    for (uint32_t attempt = 0; attempt < GT511_REVOKE_ATTEMPTS; attempt++)
+    {
+        err = GT511_DeleteID(id);
+        if (err == GT511_ERR_OTHER_ERROR)
+        {
+            ConsolePrintf("revoke %u delete failed\n", (unsigned int)id);
+            continue;
+        }
+        else if ((err != GT511_ERR_NONE) && (err != GT511_ERR_IS_NOT_USED))
+        {
+            // the sensor rejected the ID so there is no point retrying
+            return err;
+        }
+
+        // the ID is revoked when the sensor says it is not used
+        err = GT511_CheckEnrolled(id);
+        if (err == GT511_ERR_IS_NOT_USED)
+        {
+            if (pTicks)
+            {
+                *pTicks = GetTicks() - startTicks;
+            }
+            return GT511_ERR_NONE;
+        }
+        else if (err == GT511_ERR_NONE)
+        {
+            // still enrolled so report that if there are no more attempts
+            err = GT511_ERR_IS_ALREADY_USED;
+        }
+        else if (err != GT511_ERR_OTHER_ERROR)
+        {
+            return err;
+        }
+        ConsolePrintf("revoke %u not confirmed: %s\n", (unsigned int)id,
+                      GT511_ErrorString(err));
+    }
+
+    return err;
+}
+
+/**
+ * Get the count of enrolled IDs
+ *
+ * @param pEnrolledCount pointer to storage for the enrolled count
+ *
+ * This function will query the fingerprint reader for the total number
+ * of enrollments and return the count through the *pEnrolledCount*
+ * argument.  The value is only meaningful if the function return code
+ * is *GT511_ERR_NONE*.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetEnrollCount(uint32_t *pEnrolledCount)
+{
+    uint32_t parm = 0;
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_ENROLL_COUNT, &parm);
+
+    // Read id from response parameter.  Not meaningful if err != _NONE
+    if (pEnrolledCount != NULL)
+    {
+        *pEnrolledCount = parm;
+    }
+
+    return err;
+}
+
+/**
+ * Check if a specific ID is enrolled
+ *
+ * @param id index of ID to check for enrollment
+ *
+ * This function will query the fingerprint reader to find out if the
+ * the specific ID is enrolled.
+ *
+ * @return **GT511_ERR_NONE** if the specified index *IS* enrolled.
+ * **GT511_ERR_IS_NOT_USED** if the specified index *IS NOT* enrolled.
+ * Any other return value indicates an error.
+ */
+GT511_Error_t
+GT511_CheckEnrolled(uint32_t id)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_CHECK_ENROLLED, &id);
+    return err;
+}
+
+/**
+ * Verify fingerprint for specific ID
+ *
+ * @param id index of ID to verify
+ *
+ * This function will check a fingerprint match of a specific ID.
+ *
+ * @return **GT511_ERR_NONE** if the specified index has a fingerprint
+ * match.  **GT511_ERR_VERIFY_FAILED** if the specified index does not
+ * match the fingerprint.  Any other return value indicates an error.
+ */
+GT511_Error_t
+GT511_Verify(uint32_t id)
+{
+    GT511_Error_t err = IssueCommand(GT511_CMD_VERIFY, &id);
+    return err;
+}
+
+/**
+ * Find an unused ID index.
+ *
+ * @param pId pointer to available ID index
+ *
+ * Will check each ID index (slot) in sequence until an unused one is found.
+ * It will return the available index number through the pointer *pId*.
+ *
+ * @return **GT511_ERR_NONE** if an empty index was found.  If no empty
+ * slot is found then **GT511_ERR_INVALID_POS** is returned.
+ */
+GT511_Error_t
+GT511_FindAvailable(uint32_t *pId)
+{
+    // validate argument
+    if (!pId)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    ConsolePrintf("FindAvailable()\n");
+
+    // iterate over all possible ID slots
+    for (uint32_t i = 0; i < GT511_NUM_SLOTS; i++)
+    {
+        ConsolePrintf("slot %u: ", (unsigned int)i);
+
+        // check to see if this slot has an enrollment
+        uint32_t parm = i;
+        GT511_Error_t err = IssueCommand(GT511_CMD_CHECK_ENROLLED, &parm);
+
+        // if this slot is not used then return it as available
+        if (err == GT511_ERR_IS_NOT_USED)
+        {
+            ConsolePrintf("OK\n");
+            *pId = i;
+            return GT511_ERR_NONE;
+        }
+
+        // check for any other unexpected return error code
+        else if (err != GT511_ERR_NONE)
+        {
+            ConsolePrintf("ERROR: %s\n", GT511_ErrorString(err));
+            return err;
+        }
+        else
+        {
+            ConsolePrintf("IN USE\n");
+        }
+    }
+
+    // if we get here then no empty slots were found
+    return GT511_ERR_INVALID_POS;
+}
+
+#if GT511_ENABLE_TEMPLATE_IO
+/**
+ * Get the template of an enrolled fingerprint.
+ *
+ * @param id index ID of the enrolled fingerprint
+ * @param pTemplate storage for the returned template
+ * @param size number of bytes of storage at _pTemplate_
+ *
+ * The template is received directly into the caller's storage, which
+ * must be at least GT511_TEMPLATE_SIZE bytes.  The storage is only used
+ * during the call.  No memory is allocated by the driver.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetTemplate(uint32_t id, uint8_t *pTemplate, uint32_t size)
+{
+    if (!pTemplate || (size < GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint32_t parm = id;
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_TEMPLATE, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    err = ReceiveData(pTemplate, GT511_TEMPLATE_SIZE);
+
+    // remember the hash so that later comparisons need no download
+    if (err == GT511_ERR_NONE)
+    {
+        GT511_Hash_t hash;
+        GT511_HashTemplate(pTemplate, GT511_TEMPLATE_SIZE, &hash);
+        SaveTemplateHash(id, &hash);
+    }
+    return err;
+}
+
+/**
+ * Store a template as an enrolled fingerprint.
+ *
+ * @param id index ID to use for the fingerprint
+ * @param checkDuplicate **true** to reject a fingerprint that is
+ *        already enrolled at another index
+ * @param pTemplate points at the template to store
+ * @param size number of bytes at _pTemplate_
+ *
+ * The template is sent directly from the caller's storage, which must
+ * hold GT511_TEMPLATE_SIZE bytes.  The storage is only used during the
+ * call.  No memory is allocated by the driver.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_SetTemplate(uint32_t id, bool checkDuplicate, uint8_t *pTemplate, uint32_t size)
+{
+    if (!pTemplate || (size != GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    // the duplicate check is turned off by setting the upper half
+    // of the parameter
+    uint32_t parm = id | (checkDuplicate ? 0 : 0x00010000);
+    GT511_Error_t err = IssueCommand(GT511_CMD_SET_TEMPLATE, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    ForgetID(id);
+    err = IssueData(pTemplate, GT511_TEMPLATE_SIZE, NULL);
+
+    // the hash of the stored template is known without reading it back
+    if (err == GT511_ERR_NONE)
+    {
+        GT511_Hash_t hash;
+        GT511_HashTemplate(pTemplate, GT511_TEMPLATE_SIZE, &hash);
+        SaveTemplateHash(id, &hash);
+    }
+    return err;
+}
+
+/**
+ * Get the template of an enrolled fingerprint in pieces.
+ *
+ * @param id index ID of the enrolled fingerprint
+ * @param pfnWrite function that is passed each piece of the template
+ * @param pContext application context passed to _pfnWrite_
+ *
+ * This works like GT511_GetTemplate() except that the template is passed
+ * to the application a few bytes at a time as it arrives from the
+ * sensor, instead of into a buffer.  This allows the application to
+ * compress or store the template while it is being transferred.  The
+ * template is only valid if this function returns **GT511_ERR_NONE**.
+ * If _pfnWrite_ returns **false** it is not called again, and the rest
+ * of the template is read and discarded before the function returns
+ * **GT511_ERR_OTHER_ERROR**.
+ * The hash of the template is saved for GT511_GetTemplateHash().
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetTemplateStream(uint32_t id, GT511_WriteData_t pfnWrite, void *pContext)
+{
+    if (!pfnWrite)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint32_t parm = id;
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_TEMPLATE, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    GT511_Hash_t hash;
+    err = ReceiveDataStream(pfnWrite, pContext, &hash);
+    if (err == GT511_ERR_NONE)
+    {
+        SaveTemplateHash(id, &hash);
+    }
+    return err;
+}
+
+/**
+ * Store a template as an enrolled fingerprint, in pieces.
+ *
+ * @param id index ID to use for the fingerprint
+ * @param checkDuplicate **true** to reject a fingerprint that is
+ *        already enrolled at another index
+ * @param pfnRead function that provides each piece of the template
+ * @param pContext application context passed to _pfnRead_
+ *
+ * This works like GT511_SetTemplate() except that the template is asked
+ * for a few bytes at a time as it is sent to the sensor, instead of
+ * from a buffer.  This allows the application to decompress or read the
+ * template from storage while it is being transferred, so the template
+ * never needs to be held in memory.  If _pfnRead_ returns **false** it
+ * is not called again.  The rest of the packet is sent as filler with a
+ * wrong checksum, so that the sensor rejects the packet and does not
+ * store the template, and the serial link stays in step.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_SetTemplateStream(uint32_t id, bool checkDuplicate,
+                        GT511_ReadData_t pfnRead, void *pContext)
+{
+    if (!pfnRead)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint32_t parm = id | (checkDuplicate ? 0 : 0x00010000);
+    GT511_Error_t err = IssueCommand(GT511_CMD_SET_TEMPLATE, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    ForgetID(id);
+
+    GT511_Hash_t hash;
+    err = IssueDataStream(pfnRead, pContext, &hash);
+    if (err == GT511_ERR_NONE)
+    {
+        SaveTemplateHash(id, &hash);
+    }
+    return err;
+}
+
+/**
+ * Compute the hash of a template.
+ *
+ * @param pTemplate points at the template
+ * @param size number of bytes at _pTemplate_
+ *
+ * @param pHash storage for the hash
+ *
+ * This computes the same hash as GT511_GetTemplateHash(), so that a
+ * template held by the application can be compared with a template
+ * enrolled in the sensor without downloading it.  The template must be
+ * GT511_TEMPLATE_SIZE bytes.  The hash is the first 128 bits of the
+ * SHA-256 digest of the template, so it is not practical to make a
+ * different template with the same hash, and it can be used as the key
+ * to store each distinct template only once.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_HashTemplate(const uint8_t *pTemplate, uint32_t size, GT511_Hash_t *pHash)
+{
+    if (!pTemplate || (size != GT511_TEMPLATE_SIZE) || !pHash)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    HashContext_t ctx;
+    HashInit(&ctx);
+    HashUpdate(&ctx, pTemplate, size);
+    HashFinal(&ctx, pHash);
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Get the hash of the template of an enrolled fingerprint.
+ *
+ * @param id index ID of the enrolled fingerprint
+ * @param pHash storage for the returned hash
+ *
+ * The driver remembers the hash of each enrolled template that it has
+ * read or stored.  If the hash for _id_ is known then it is returned
+ * without any communication with the sensor.  Otherwise the template is
+ * read from the sensor to compute the hash, without needing storage for
+ * the template.  The saved hash is forgotten when the ID is enrolled or
+ * deleted through the driver.  If the sensor database is changed some
+ * other way then GT511_ForgetTemplateHashes() must be called.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetTemplateHash(uint32_t id, GT511_Hash_t *pHash)
+{
+    if (!pHash || (id >= GT511_NUM_SLOTS))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    if (templateHashValid[id / 32] & (1UL << (id % 32)))
+    {
+        *pHash = templateHash[id];
+        return GT511_ERR_NONE;
+    }
+
+    uint32_t parm = id;
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_TEMPLATE, &parm);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    err = ReceiveDataStream(NULL, NULL, &templateHash[id]);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    templateHashValid[id / 32] |= 1UL << (id % 32);
+    *pHash = templateHash[id];
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Forget all saved template hashes.
+ *
+ * This must be called if the sensor database is changed other than
+ * through this driver, for example if the sensor is replaced.
+ */
+void
+GT511_ForgetTemplateHashes(void)
+{
+    memset(templateHashValid, 0, sizeof(templateHashValid));
+}
+
+/**
+ * Make a template from a captured fingerprint.
+ *
+ * @param pTemplate storage for the returned template
+ * @param size number of bytes of storage at _pTemplate_
+ *
+ * A fingerprint must first be captured with GT511_CaptureFinger().  The
+ * template is received directly into the caller's storage, which must be
+ * at least GT511_TEMPLATE_SIZE bytes.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_MakeTemplate(uint8_t *pTemplate, uint32_t size)
+{
+    if (!pTemplate || (size < GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = IssueCommand(GT511_CMD_MAKE_TEMPLATE, NULL);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    return ReceiveData(pTemplate, GT511_TEMPLATE_SIZE);
+}
+
+/**
+ * Verify a template against a specific ID
+ *
+ * @param id index ID to verify against
+ * @param pTemplate points at the template to verify
+ * @param size number of bytes at _pTemplate_
+ *
+ * The template is sent to the sensor and compared with the fingerprint
+ * enrolled at _id_.  The template must be GT511_TEMPLATE_SIZE bytes.
+ *
+ * @return **GT511_ERR_NONE** if the template matches.
+ * **GT511_ERR_VERIFY_FAILED** if it does not match.  Any other return
+ * value indicates an error.
+ */
+GT511_Error_t
+GT511_VerifyTemplate(uint32_t id, uint8_t *pTemplate, uint32_t size)
+{
+    if (!pTemplate || (size != GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = IssueCommand(GT511_CMD_VERIFY_TEMPLATE, &id);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    return IssueData(pTemplate, GT511_TEMPLATE_SIZE, NULL);
+}
+
+/**
+ * Identify a template
+ *
+ * @param pTemplate points at the template to identify
+ * @param size number of bytes at _pTemplate_
+ * @param pId pointer to the ID value of the identified fingerprint
+ *
+ * The template is sent to the sensor and compared with all enrolled
+ * fingerprints.  The template must be GT511_TEMPLATE_SIZE bytes.  If a
+ * match is found then its index ID is stored at _*pId_.
+ *
+ * @return **GT511_ERR_NONE** if a match was found.
+ * **GT511_ERR_IDENTIFY_FAILED** if there is no match.  Any other return
+ * value indicates an error.
+ */
+GT511_Error_t
+GT511_IdentifyTemplate(uint8_t *pTemplate, uint32_t size, uint32_t *pId)
+{
+    if (!pTemplate || (size != GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = IssueCommand(GT511_CMD_IDENTIFY_TEMPLATE, NULL);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    // Read id from response parameter.  Not meaningful if err != _NONE
+    uint32_t parm = 0;
+    err = IssueData(pTemplate, GT511_TEMPLATE_SIZE, &parm);
+    if (pId != NULL)
+    {
+        *pId = parm;
+    }
+    return err;
+}
+
+/**
+ * Start identifying a template
+ *
+ * @param pTemplate points at the template to identify
+ * @param size number of bytes at _pTemplate_
+ *
+ * This is the first half of GT511_IdentifyTemplate().  The template is
+ * sent to the sensor, but the driver does not wait for the sensor to
+ * search its database.  The result must be collected with
+ * GT511_IdentifyTemplateFinish() before any other command is sent to the
+ * same sensor.  In between, the application can talk to another sensor
+ * on a different serial port, so that several sensors search at the
+ * same time (see GT511_IdentifyTemplateShards()).  The serial transport
+ * must keep the bytes that arrive on each port until they are read.
+ *
+ * @return **GT511_ERR_NONE** if the template was sent.  Any other return
+ * value indicates an error, and there is no result to collect.
+ */
+GT511_Error_t
+GT511_IdentifyTemplateStart(uint8_t *pTemplate, uint32_t size)
+{
+    if (!pTemplate || (size != GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = IssueCommand(GT511_CMD_IDENTIFY_TEMPLATE, NULL);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    uint32_t startTicks = GetTicks();
+    if (!SendData(pTemplate, GT511_TEMPLATE_SIZE))
+    {
+        CommandDone(GT511_TRACE_DATA, GT511_TEMPLATE_SIZE, NULL,
+                    GT511_ERR_OTHER_ERROR, startTicks);
+        return GT511_ERR_OTHER_ERROR;
+    }
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Finish identifying a template
+ *
+ * @param pId pointer to the ID value of the identified fingerprint
+ *
+ * This is the second half of GT511_IdentifyTemplate().  It waits for the
+ * result of the search started by GT511_IdentifyTemplateStart().  If a
+ * match is found then its index ID is stored at _*pId_.  The trace
+ * record of the template data packet is made here, and its times cover
+ * only the wait for the result.
+ *
+ * @return **GT511_ERR_NONE** if a match was found.
+ * **GT511_ERR_IDENTIFY_FAILED** if there is no match.  Any other return
+ * value indicates an error.
+ */
+GT511_Error_t
+GT511_IdentifyTemplateFinish(uint32_t *pId)
+{
+    // Read id from response parameter.  Not meaningful if err != _NONE
+    uint32_t parm = 0;
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = ReceiveAck(&parm);
+    CommandDone(GT511_TRACE_DATA, GT511_TEMPLATE_SIZE, &parm, err, startTicks);
+    if (pId != NULL)
+    {
+        *pId = parm;
+    }
+    return err;
+}
+
+/**
+ * Identify a template against several sensors
+ *
+ * @param pTemplate points at the template to identify
+ * @param size number of bytes at _pTemplate_
+ * @param count number of sensors to search, from 1 to 32
+ * @param pfnSelect function that selects the serial port of a sensor
+ * @param pContext application context passed to _pfnSelect_
+ * @param pId storage for the ID of the identified fingerprint
+ * @param pShard storage for the number of the sensor that matched
+ *
+ * This is for a group of sensors that each hold a different part of a
+ * larger set of fingerprints, and that each have their own serial port.
+ * The sensors are numbered from 0 to _count_ - 1, and before talking to
+ * a sensor the driver calls _pfnSelect_ with its number so that the
+ * serial transport can switch to its port.  The transport must keep the
+ * bytes that arrive on each port until they are read.  All the sensors
+ * use the selected device ID, so stock sensors can be used.
+ *
+ * A template made once, for example with GT511_MakeTemplate() on the
+ * sensor the person touched, is sent to every sensor with
+ * GT511_IdentifyTemplateStart(), and then the results are collected
+ * with GT511_IdentifyTemplateFinish().  The sensors therefore search at
+ * the same time, and the search takes about as long as the slowest
+ * sensor rather than the sum of all of them.  Sensors that share one
+ * serial line cannot be searched this way, because they answer as soon
+ * as they finish and would talk over each other.  They must be searched
+ * one at a time with GT511_IdentifyTemplate().
+ *
+ * The results are collected in sensor order, and every sensor is waited
+ * for so that each port is left ready for the next command.  If more
+ * than one sensor matches, the lowest numbered one is returned rather
+ * than the first to answer.  This gives the same result each time, at
+ * the cost of waiting for the slowest sensor even when a match has been
+ * found.  On return the last sensor is still selected.
+ *
+ * @return **GT511_ERR_NONE** if a match was found.
+ * **GT511_ERR_IDENTIFY_FAILED** if no sensor has a match.  If any
+ * sensor could not be searched and there was no match, then the error
+ * from that sensor is returned.
+ */
+GT511_Error_t
+GT511_IdentifyTemplateShards(uint8_t *pTemplate, uint32_t size, uint32_t count,
+                             GT511_SelectShard_t pfnSelect, void *pContext,
+                             uint32_t *pId, uint32_t *pShard)
+{
+    if (!pfnSelect || !count || (count > 32))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t result = GT511_ERR_IDENTIFY_FAILED;
+    bool found = false;
+
+    // send the template to every sensor, remembering which ones started
+    uint32_t started = 0;
+    for (uint32_t shard = 0; shard < count; shard++)
+    {
+        pfnSelect(pContext, shard);
+        GT511_Error_t err = GT511_IdentifyTemplateStart(pTemplate, size);
+        if (err == GT511_ERR_NONE)
         {
-            ConsolePrintf("touch wait timeout\n");
-            GT511_UserCallback(mode, GT511_UI_TIMEOUT);
-            return GT511_ERR_OTHER_ERROR;
+            started |= 1UL << shard;
+        }
+        else if (err != GT511_ERR_DB_IS_EMPTY)
+        {
+            result = err;
         }
+    }
 
-        // check for finger press
-        err = GT511_IsPressFinger(&isPressed);
-        if (err != GT511_ERR_NONE)
+    // then collect the results, in the same order
+    for (uint32_t shard = 0; shard < count; shard++)
+    {
+        if (!(started & (1UL << shard)))
         {
-            GT511_CmosLed(false);
-            ConsolePrintf("error checking for finger press: %s\n",
-                          GT511_ErrorString(err));
-            GT511_UserCallback(mode, GT511_UI_ERROR);
-            return err;
+            continue;
+        }
+        pfnSelect(pContext, shard);
+        uint32_t id;
+        GT511_Error_t err = GT511_IdentifyTemplateFinish(&id);
+        if (err == GT511_ERR_NONE)
+        {
+            if (!found)
+            {
+                found = true;
+                if (pId)
+                {
+                    *pId = id;
+                }
+                if (pShard)
+                {
+                    *pShard = shard;
+                }
+            }
+        }
+        else if ((err != GT511_ERR_IDENTIFY_FAILED) && (err != GT511_ERR_DB_IS_EMPTY))
+        {
+            result = err;
+        }
+    }
+
+    return found ? GT511_ERR_NONE : result;
+}
+
+/**
+ * Identify a batch of templates
+ *
+ * @param pTemplates points at the templates, one after the other
+ * @param count number of templates at _pTemplates_
+ * @param pIds storage for the matched ID of each template
+ * @param pDone storage for the number of templates that were processed
+ * @param pfnPreempt optional function to check if the batch should stop
+ * @param pContext application context passed to _pfnPreempt_
+ *
+ * This lets an idle reader be used to match templates for the
+ * application.  Each template, of GT511_TEMPLATE_SIZE bytes, is
+ * identified against the sensor database in turn with
+ * GT511_IdentifyTemplate().  The matched ID is stored in _pIds_, or
+ * GT511_ID_NONE if there is no match.  Before each template
+ * _pfnPreempt_ is called if it is not NULL.  If it returns **true**,
+ * for example because a person has walked up to the reader, then the
+ * batch stops so that the reader can be used for them.  The application
+ * can submit the remaining templates later.
+ *
+ * @return **GT511_ERR_NONE** if all templates were processed or the
+ * batch was preempted.  *pDone* is the number of templates processed.
+ * Any other value is an error from the template at index *pDone*.
+ */
+GT511_Error_t
+GT511_IdentifyTemplateBatch(uint8_t *pTemplates, uint32_t count, uint32_t *pIds,
+                            uint32_t *pDone, GT511_Preempt_t pfnPreempt,
+                            void *pContext)
+{
+    if (!pTemplates || !pIds || !pDone)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = GT511_ERR_NONE;
+    uint32_t idx;
+    for (idx = 0; idx < count; idx++)
+    {
+        if (pfnPreempt && pfnPreempt(pContext))
+        {
+            ConsolePrintf("identify batch preempted at %u\n", (unsigned int)idx);
+            break;
+        }
+
+        err = GT511_IdentifyTemplate(&pTemplates[idx * GT511_TEMPLATE_SIZE],
+                                     GT511_TEMPLATE_SIZE, &pIds[idx]);
+        if (err == GT511_ERR_IDENTIFY_FAILED)
+        {
+            pIds[idx] = GT511_ID_NONE;
+            err = GT511_ERR_NONE;
+        }
+        else if (err != GT511_ERR_NONE)
+        {
+            break;
         }
-    } while (!isPressed);
+    }
+
+    *pDone = idx;
+    return err;
+}
+#endif
+
+#if GT511_ENABLE_IMAGE_IO
+/**
+ * Get the image of a captured fingerprint.
+ *
+ * @param pImage storage for the returned image
+ * @param size number of bytes of storage at _pImage_
+ *
+ * A fingerprint must first be captured with GT511_CaptureFinger().  The
+ * image is received directly into the caller's storage, which must be
+ * at least GT511_IMAGE_SIZE bytes.  The storage is only used during the
+ * call.  No memory is allocated by the driver.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetImage(uint8_t *pImage, uint32_t size)
+{
+    if (!pImage || (size < GT511_IMAGE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_IMAGE, NULL);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    return ReceiveData(pImage, GT511_IMAGE_SIZE);
+}
+
+/**
+ * Get a raw image from the sensor.
+ *
+ * @param pImage storage for the returned image
+ * @param size number of bytes of storage at _pImage_
+ *
+ * This returns the current sensor image at a reduced resolution, without
+ * the need to capture a fingerprint first.  The image is received
+ * directly into the caller's storage, which must be at least
+ * GT511_RAW_IMAGE_SIZE bytes.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetRawImage(uint8_t *pImage, uint32_t size)
+{
+    if (!pImage || (size < GT511_RAW_IMAGE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
 
-    ConsolePrintf("touch detected\n");
-    return err;
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_RAW_IMAGE, NULL);
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+    return ReceiveData(pImage, GT511_RAW_IMAGE_SIZE);
 }
 
-/*
- * Wait for user to release sensor touch.
+/**
+ * Find how much of an image is covered by a fingerprint.
  *
- * @param mode the current mode of the driver (identify, enroll, etc)
+ * @param pImage points at the image, 8 bits per pixel
+ * @param width width of the image in pixels
+ * @param height height of the image in pixels
+ * @param pCoverage storage for the coverage, in percent
  *
- * This function will use the GT511_UserCallback() to prompt the user
- * to release the sensor, and to then wait for the user to release the
- * sensor.  At the start GT511_SetTimeout() will be called to allow the
- * application set a timeout if needed.  While waiting then
- * GT511_CheckTimeout() will be repeatedly called to see if a timeout
- * occurs.  This function will wait until either it correctly detects the
- * touch has been released, or the timeout occurs, or some other error happens.
+ * The image is divided into square blocks of GT511_SEGMENT_BLOCK pixels
+ * and each block is classed as fingerprint or background by the
+ * variance of its pixels.  Ridges give a high variance while empty areas
+ * of the sensor are flat.  A block whose variance is above
+ * GT511_SEGMENT_THRESHOLD counts as fingerprint.  Partial blocks at the
+ * right and bottom edges are ignored.
  *
- * @return **GT511_ERR_NONE** if the touch was released.  If the timeout
- * happens then it will return **GT511_ERR_OTHER_ERROR**.  If any other
- * error occurs then that code will be returned.  The function was not
- * successful at detecting a release if anything other than GT511_ERR_NONE
- * is returned.
+ * This is the segmentation step of host-side image processing.  It can
+ * be used with an image from GT511_GetImage() or GT511_GetRawImage()
+ * to reject a partial placement before matching.  It uses integer
+ * arithmetic only and no memory besides the image.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
  */
-static GT511_Error_t
-WaitFingerRelease(GT511_Mode_t mode)
+GT511_Error_t
+GT511_ImageCoverage(const uint8_t *pImage, uint32_t width, uint32_t height,
+                    uint32_t *pCoverage)
 {
-    GT511_Error_t err;
-    // wait for a finger release
-    GT511_UserCallback(mode, GT511_UI_RELEASE);
-    ConsolePrintf("waiting for release\n");
-    bool isPressed = true;
-    GT511_SetTimeout(mode);
-    do
+    const uint32_t block = GT511_SEGMENT_BLOCK;
+    const uint32_t pixels = block * block;
+    uint32_t blocksWide = width / block;
+    uint32_t blocksHigh = height / block;
+    if (!pImage || !pCoverage || !blocksWide || !blocksHigh)
     {
-        // check for timeout from app
-        bool timeout = GT511_CheckTimeout(mode);
-        if (timeout)
-        {
-            ConsolePrintf("release wait timeout\n");
-            GT511_UserCallback(mode, GT511_UI_TIMEOUT);
-            return GT511_ERR_OTHER_ERROR;
-        }
+        return GT511_ERR_OTHER_ERROR;
+    }
 
-        // check for finger press
-        err = GT511_IsPressFinger(&isPressed);
-        if (err != GT511_ERR_NONE)
+    uint32_t covered = 0;
+    for (uint32_t by = 0; by < blocksHigh; by++)
+    {
+        for (uint32_t bx = 0; bx < blocksWide; bx++)
         {
-            GT511_CmosLed(false);
-            ConsolePrintf("error checking for finger press: %s\n",
-                          GT511_ErrorString(err));
-            GT511_UserCallback(mode, GT511_UI_ERROR);
-            return err;
+            // sum and sum of squares of the block pixels
+            const uint8_t *pRow = &pImage[(by * block * width) + (bx * block)];
+            uint32_t sum = 0;
+            uint32_t sumSquares = 0;
+            for (uint32_t y = 0; y < block; y++)
+            {
+                for (uint32_t x = 0; x < block; x++)
+                {
+                    sum += pRow[x];
+                    sumSquares += pRow[x] * pRow[x];
+                }
+                pRow += width;
+            }
+
+            // variance = (sum(x^2) - sum(x)^2 / n) / n, where the square
+            // of the sum needs 64 bits once the block is over 16 pixels
+            uint64_t sumSquared = (uint64_t)sum * sum;
+            uint32_t variance = (sumSquares - (uint32_t)(sumSquared / pixels)) / pixels;
+            if (variance > GT511_SEGMENT_THRESHOLD)
+            {
+                ++covered;
+            }
         }
-    } while (isPressed);
+    }
 
-    ConsolePrintf("release detected\n");
-    return err;
+    *pCoverage = (covered * 100) / (blocksWide * blocksHigh);
+    return GT511_ERR_NONE;
 }
 
-// Define a table to map error codes to human readable strings
-typedef struct
-{
-    GT511_Error_t errCode;
-    const char *errString;
-} ErrorStringTable_t;
-
-static const ErrorStringTable_t errorStringTable[] =
-{
-    { GT511_ERR_NONE, "NONE" },
-    { GT511_ERR_TIMEOUT, "TIMEOUT" },
-    { GT511_ERR_INVALID_BAUDRATE, "INVALID_BAUDRATE" },
-    { GT511_ERR_INVALID_POS, "INVALID_POS" },
-    { GT511_ERR_IS_NOT_USED, "IS_NOT_USED" },
-    { GT511_ERR_IS_ALREADY_USED, "IS_ALREADY_USED" },
-    { GT511_ERR_COMM_ERR, "COMM_ERR" },
-    { GT511_ERR_VERIFY_FAILED, "VERIFY_FAILED" },
-    { GT511_ERR_IDENTIFY_FAILED, "IDENTIFY_FAILED" },
-    { GT511_ERR_DB_IS_FULL, "DB_IS_FULL" },
-    { GT511_ERR_DB_IS_EMPTY, "DB_IS_EMPTY" },
-    { GT511_ERR_TURN_ERR, "TURN_ERR" },
-    { GT511_ERR_BAD_FINGER, "BAD_FINGER" },
-    { GT511_ERR_ENROLL_FAILED, "ENROLL_FAILED" },
-    { GT511_ERR_IS_NOT_SUPPORTED, "IS_NOT_SUPPORTED" },
-    { GT511_ERR_DEV_ERR, "DEV_ERR" },
-    { GT511_ERR_CAPTURE_CANCELED, "CAPTURE_CANCELED" },
-    { GT511_ERR_INVALID_PARAM, "INVALID_PARAM" },
-    { GT511_ERR_FINGER_IS_NOT_PRESSED, "FINGER_IS_NOT_PRESSED" },
-    { GT511_ERR_OTHER_ERROR, "OTHER_ERROR" },
-};
-#define NUM_ERR_STRINGS (sizeof(errorStringTable) / sizeof(ErrorStringTable_t))
-
-/******************************************************************************
- * Public API
- *****************************************************************************/
-
-/**
- * Return string representation of error code.
+/*
+ * Get a raw image from the sensor and add it to a sum of raw images.
  *
- * @param err the error code to check
+ * @param pHigh high byte of the sum for each pixel
+ * @param pLow low byte of the sum for each pixel
  *
- * This can be used for debugging to print a string name of the error code.
+ * The image is received in small pieces and added straight into the
+ * sum, so that no storage is needed for the image itself.  If the packet
+ * turns out not to be valid then the sum is spoiled.
  *
- * @return A string representation of the error code.  If the error code
- * does not match any known value then "UNKNOWN" is returned.
+ * @return **GT511_ERR_NONE** if a valid image was added.
  */
-const char *
-GT511_ErrorString(GT511_Error_t err)
+static GT511_Error_t
+AddRawImage(uint8_t *pHigh, uint8_t *pLow)
 {
-    for (uint32_t i = 0; i < NUM_ERR_STRINGS; i++)
+    GT511_Error_t err = IssueCommand(GT511_CMD_GET_RAW_IMAGE, NULL);
+    if (err != GT511_ERR_NONE)
     {
-        if (errorStringTable[i].errCode == err)
+        return err;
+    }
+
+    uint16_t checksum;
+    uint32_t startTicks = GetTicks();
+    err = ReceiveDataHeader(&checksum);
+    uint8_t chunk[GT511_STREAM_CHUNK_SIZE];
+    uint32_t idx = 0;
+    while ((err == GT511_ERR_NONE) && (idx < GT511_RAW_IMAGE_SIZE))
+    {
+        uint32_t remaining = GT511_RAW_IMAGE_SIZE - idx;
+        uint32_t length = (remaining < sizeof(chunk)) ? remaining : sizeof(chunk);
+        uint32_t count = ReceiveMessage(chunk, length);
+        if (count != length)
         {
-            return errorStringTable[i].errString;
+            err = GT511_ERR_OTHER_ERROR;
+            break;
+        }
+        checksum += Checksum(chunk, length);
+        for (uint32_t i = 0; i < length; i++, idx++)
+        {
+            uint32_t sum = ((uint32_t)pHigh[idx] << 8) + pLow[idx] + chunk[i];
+            pHigh[idx] = (uint8_t)(sum >> 8);
+            pLow[idx] = (uint8_t)sum;
         }
     }
-    return "UNKNOWN";
+
+    if (err == GT511_ERR_NONE)
+    {
+        err = ReceiveDataChecksum(checksum);
+    }
+    DataReceived(GT511_RAW_IMAGE_SIZE, err, startTicks);
+    return err;
 }
 
 /**
- * Open the fingerprint reader for operation.
+ * Build a background image of the empty sensor.
  *
- * @param pInfo optional pointer for retrieving sensor info
+ * @param pBaseline storage for the background image
+ * @param pWork storage used while the raw images are added up
+ * @param size number of bytes of storage at each of _pBaseline_ and
+ * _pWork_
+ * @param frames number of raw images to average, from 1 to 256
  *
- * The _pInfo_ parameter is optional and can be NULL.  If not NULL, then
- * it will be populated with the information returned from the sensor.
+ * This is a maintenance function to be run when nobody is using the
+ * reader.  It takes _frames_ raw images (see GT511_GetRawImage()) of the
+ * empty sensor and averages them into _pBaseline_.  The background shows
+ * dirt and grease on the sensor window, which can be measured with
+ * GT511_ScoreBaseline() and removed from later raw images with
+ * GT511_SubtractBaseline().  Both buffers must be at least
+ * GT511_RAW_IMAGE_SIZE bytes.  The images are added up exactly, with
+ * _pBaseline_ and _pWork_ holding the high and low bytes of a 16-bit sum
+ * for each pixel, so the average is rounded only once.  The CMOS LED
+ * must be on.
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * @return **GT511_ERR_NONE** if no errors occurred.  If a finger is on
+ * the sensor then **GT511_ERR_OTHER_ERROR** is returned.  The baseline
+ * is not valid if any error is returned.
  */
 GT511_Error_t
-GT511_Open(GT511_Info_t *pInfo)
+GT511_CaptureBaseline(uint8_t *pBaseline, uint8_t *pWork, uint32_t size,
+                      uint32_t frames)
 {
-    uint32_t parm = pInfo ? 1 : 0;
-
-    // Send the command and check response
-    GT511_Error_t err = IssueCommand(GT511_CMD_OPEN, &parm);
-    if (err != GT511_ERR_NONE)
+    if (!pBaseline || !pWork || (size < GT511_RAW_IMAGE_SIZE)
+     || (frames < 1) || (frames > 256))
     {
-        return err;
+        return GT511_ERR_OTHER_ERROR;
     }
 
-    // If user asked for extra info, collect the info data which should
-    // be forthcoming
-    if (pInfo)
+    memset(pBaseline, 0, GT511_RAW_IMAGE_SIZE);
+    memset(pWork, 0, GT511_RAW_IMAGE_SIZE);
+    for (uint32_t frame = 0; frame < frames; frame++)
     {
-        // Receive a data packet containing the extra info
-        GT511_DataPacket_t *pData = (GT511_DataPacket_t *)mempool;
-        uint32_t dataLength = sizeof(GT511_DataPacket_t) + sizeof(GT511_Info_t);
-        uint32_t dataCount = GT511_ReceiveMessage((uint8_t *)pData, dataLength);
-        if (dataCount != dataLength)
+        bool isPressed;
+        GT511_Error_t err = GT511_IsPressFinger(&isPressed);
+        if (err != GT511_ERR_NONE)
+        {
+            return err;
+        }
+        if (isPressed)
         {
             return GT511_ERR_OTHER_ERROR;
         }
 
-        // Copy the extra info fields to the callers storage
-        GT511_Info_t *pThisInfo = (GT511_Info_t *)&pData->payload[0];
-        pInfo->firmwareVersion = pThisInfo->firmwareVersion;
-        pInfo->isoAreaMaxSize = pThisInfo->isoAreaMaxSize;
-        memcpy(&pInfo->serialNumber[0], &pThisInfo->serialNumber[0], 16);
+        err = AddRawImage(pBaseline, pWork);
+        if (err != GT511_ERR_NONE)
+        {
+            return err;
+        }
+    }
+
+    // the average of the frames, rounded to nearest
+    for (uint32_t idx = 0; idx < GT511_RAW_IMAGE_SIZE; idx++)
+    {
+        uint32_t sum = ((uint32_t)pBaseline[idx] << 8) | pWork[idx];
+        pBaseline[idx] = (uint8_t)((sum + (frames / 2)) / frames);
     }
 
-    // If we got this far then there are no errors.
     return GT511_ERR_NONE;
 }
 
 /**
- * Close the fingerprint reader for operation.
+ * Score how dirty the sensor window is.
+ *
+ * @param pBaseline the background image from GT511_CaptureBaseline()
+ * @param size number of bytes at _pBaseline_
+ * @param pScore storage for the score, 0 (clean) to 100
+ *
+ * A clean empty sensor gives an even background.  Dirt, grease and
+ * latent prints leave texture, which is measured in the same way as
+ * GT511_ImageCoverage() measures a fingerprint.  The score is the
+ * percentage of the window that is marked.  It can be reported as a
+ * metric so that cleaning is scheduled before identification starts
+ * to fail.  The baseline must be at least GT511_RAW_IMAGE_SIZE bytes.
  *
  * @return **GT511_ERR_NONE** if no errors occurred.
  */
 GT511_Error_t
-GT511_Close(void)
+GT511_ScoreBaseline(const uint8_t *pBaseline, uint32_t size, uint32_t *pScore)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_CLOSE, NULL);
-    return err;
+    if (size < GT511_RAW_IMAGE_SIZE)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+    return GT511_ImageCoverage(pBaseline, GT511_RAW_IMAGE_WIDTH,
+                               GT511_RAW_IMAGE_HEIGHT, pScore);
 }
 
 /**
- * Control the LED backlight.
+ * Remove the sensor background from a raw image.
  *
- * @param on set to **true** to turn on the backlight, or **false** for off
+ * @param pImage the raw image from GT511_GetRawImage(), modified in place
+ * @param pBaseline the background image from GT511_CaptureBaseline()
+ * @param size number of bytes at each of _pImage_ and _pBaseline_
+ *
+ * The difference of each background pixel from the average background
+ * level is taken away from the image, so that marks on the sensor window
+ * are flattened out while the overall brightness of the image is kept.
+ * This should be done before any host-side scoring of the image.  Both
+ * buffers must be at least GT511_RAW_IMAGE_SIZE bytes.
  *
  * @return **GT511_ERR_NONE** if no errors occurred.
  */
 GT511_Error_t
-GT511_CmosLed(bool on)
+GT511_SubtractBaseline(uint8_t *pImage, const uint8_t *pBaseline, uint32_t size)
 {
-    uint32_t parm = on ? 1 : 0;
-    GT511_Error_t err = IssueCommand(GT511_CMD_CMOS_LED, &parm);
-    return err;
+    if (!pImage || !pBaseline || (size < GT511_RAW_IMAGE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint32_t sum = 0;
+    for (uint32_t idx = 0; idx < GT511_RAW_IMAGE_SIZE; idx++)
+    {
+        sum += pBaseline[idx];
+    }
+    int32_t level = sum / GT511_RAW_IMAGE_SIZE;
+
+    for (uint32_t idx = 0; idx < GT511_RAW_IMAGE_SIZE; idx++)
+    {
+        int32_t pixel = (int32_t)pImage[idx] - pBaseline[idx] + level;
+        pImage[idx] = (pixel < 0) ? 0 : (pixel > 255) ? 255 : (uint8_t)pixel;
+    }
+
+    return GT511_ERR_NONE;
 }
+#endif
 
 /**
- * Check to see if a finger is pressed
+ * Provide a clock to the driver.
  *
- * @param pIsPressed storage for returned value
- *
- * The parameter *pIsPressed* points at a flag to contain the returned
- * value.  It will be set to **true** if a finger press is detected, or
- * **false** if no finger press is detected.
+ * @param pfnGetTicks function that returns the current time in ticks
+ * @param pfnSleep function that waits for a number of ticks
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * Either function can be NULL.  Without _pfnGetTicks_ the driver reports
+ * zero for all time measurements.  Without _pfnSleep_ the driver polls
+ * the sensor continuously while waiting, regardless of the poll interval.
+ * The same clock should be used by the application timeout functions
+ * GT511_SetTimeout() and GT511_CheckTimeout(), and by the serial
+ * transport if it needs to wait.  In a simulation these can all be
+ * backed by a virtual clock.
  */
-GT511_Error_t
-GT511_IsPressFinger(bool *pIsPressed)
+void
+GT511_SetClock(GT511_GetTicks_t pfnGetTicks, GT511_Sleep_t pfnSleep)
 {
-    uint32_t parm = 0;
-    GT511_Error_t err = IssueCommand(GT511_CMD_IS_PRESS_FINGER, &parm);
+    pfnAppGetTicks = pfnGetTicks;
+    pfnAppSleep = pfnSleep;
+}
 
-    // return requested flag
-    // this will have no meaning if err != _NONE
-    if (pIsPressed != NULL)
+/**
+ * Select the sensor that the driver talks to.
+ *
+ * @param id device ID of the sensor
+ *
+ * All commands are sent to the sensor with this device ID, and packets
+ * from any other sensor are rejected.  This allows several sensors to
+ * share one serial line, but only sensors whose device ID can be
+ * configured.  The stock GT-511C firmware always uses device ID 0x0001.
+ *
+ * The state that the driver saves about a sensor, such as the finger
+ * press cache, the LED state, the standby state and the template
+ * hashes, is forgotten when the device ID changes.  Use GT511_SaveState()
+ * and GT511_RestoreState() to keep it across a switch.  This should
+ * only be called when the driver is idle.
+ */
+void
+GT511_SetDeviceId(uint16_t id)
+{
+    if (id == deviceId)
     {
-        // return parameter is 0 if pressed, so we need to NOT it
-        *pIsPressed = !parm;
+        return;
     }
 
-    return err;
+    deviceId = id;
+    pressCacheValid = false;
+    ledOn = false;
+    ForgetAllIDs();
+#if GT511_ENABLE_STANDBY
+    inStandby = false;
+    standbyLedOn = false;
+    lastCommandTicks = GetTicks();
+    powerMarkTicks = lastCommandTicks;
+#endif
 }
 
 /**
- * Capture a finger print.
+ * Get the device ID of the sensor that the driver talks to.
  *
- * @param highQuality **true** to use a high quality capture
+ * @return the device ID set by GT511_SetDeviceId().
+ */
+uint16_t
+GT511_GetDeviceId(void)
+{
+    return deviceId;
+}
+
+/*
+ * Feature groups that save state in GT511_DeviceState_t.  The structure
+ * has the same layout whichever groups are built, so this is saved with
+ * the state to catch a driver that would restore only part of it.
+ */
+#define STATE_FEATURES ((GT511_ENABLE_RUN_FLOWS ? 0x01UL : 0) \
+                      | (GT511_ENABLE_TEMPLATE_IO ? 0x02UL : 0) \
+                      | (GT511_ENABLE_STANDBY ? 0x04UL : 0))
+
+/**
+ * Save the state the driver keeps about the selected sensor.
  *
- * According to the sensor data sheet, a high quality capture should be
- * used for enrollment while a normal capture used for identification.
+ * @param pState storage for the state
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * The state includes the device ID, the LED and standby state, and the
+ * information cached about each ID.  It can be given to
+ * GT511_RestoreState() in the same or another process, to carry on using
+ * the sensor without opening it again.  The driver should be idle.
+ * Settings such as timeouts, and statistics, are not included.
  */
-GT511_Error_t
-GT511_CaptureFinger(bool highQuality)
+void
+GT511_SaveState(GT511_DeviceState_t *pState)
 {
-    uint32_t parm = highQuality ? 1 : 0;
-    GT511_Error_t err = IssueCommand(GT511_CMD_CAPTURE_FINGER, &parm);
-    return err;
+    if (!pState)
+    {
+        return;
+    }
+
+    memset(pState, 0, sizeof(*pState));
+    pState->size = sizeof(*pState);
+    pState->features = STATE_FEATURES;
+    pState->deviceId = deviceId;
+    pState->ledOn = ledOn;
+#if GT511_ENABLE_STANDBY
+    pState->inStandby = inStandby;
+    pState->standbyLedOn = standbyLedOn;
+#endif
+#if GT511_ENABLE_RUN_FLOWS
+    memcpy(pState->preferHighQuality, preferHighQuality, sizeof(preferHighQuality));
+#endif
+#if GT511_ENABLE_TEMPLATE_IO
+    memcpy(pState->templateHashValid, templateHashValid, sizeof(templateHashValid));
+    memcpy(pState->templateHash, templateHash, sizeof(templateHash));
+#endif
 }
 
 /**
- * Identify a fingerprint
+ * Restore the state the driver keeps about a sensor.
  *
- * @param pId pointer to the ID value of the identified fingerprint
+ * @param pState the state from GT511_SaveState()
  *
- * If a captured fingerprint is successfully identified, then the index ID
- * of the fingerprint will be stored at _*pId_.  You must check the function
- * return value to make sure that the returned ID value is valid.
+ * The sensor the state was saved from becomes the selected sensor, and
+ * the driver carries on as it was when the state was saved.  The sensor
+ * itself must not have been changed in the meantime, for example by
+ * enrolling or deleting IDs from another process.  The finger press
+ * cache is not restored.
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * @return **GT511_ERR_NONE** if the state was restored, or
+ * **GT511_ERR_OTHER_ERROR** if it was saved by a driver with a different
+ * number of slots or different feature groups that keep state.
  */
 GT511_Error_t
-GT511_Identify(uint32_t *pId)
+GT511_RestoreState(const GT511_DeviceState_t *pState)
 {
-    uint32_t parm = 0;
-    GT511_Error_t err = IssueCommand(GT511_CMD_IDENTIFY, &parm);
-
-    // Read id from response parameter.  Not meaningful if err != _NONE
-    if (pId != NULL)
+    if (!pState || (pState->size != sizeof(*pState))
+     || (pState->features != STATE_FEATURES))
     {
-        *pId = parm;
+        return GT511_ERR_OTHER_ERROR;
     }
 
-    return err;
+    deviceId = pState->deviceId;
+    ledOn = pState->ledOn;
+    pressCacheValid = false;
+#if GT511_ENABLE_STANDBY
+    inStandby = pState->inStandby;
+    standbyLedOn = pState->standbyLedOn;
+    powerMarkTicks = GetTicks();
+    lastCommandTicks = powerMarkTicks;
+#endif
+#if GT511_ENABLE_RUN_FLOWS
+    memcpy(preferHighQuality, pState->preferHighQuality, sizeof(preferHighQuality));
+#endif
+#if GT511_ENABLE_TEMPLATE_IO
+    memcpy(templateHashValid, pState->templateHashValid, sizeof(templateHashValid));
+    memcpy(templateHash, pState->templateHash, sizeof(templateHash));
+#endif
+    return GT511_ERR_NONE;
 }
 
+#if GT511_ENABLE_STATS
 /**
- * Start enrollment
+ * Get the rolling performance figures for a command.
  *
- * @param id index ID to use for fingerprint enrollment
- *
- * This will start the enrollment process, using the specified ID index
- * to store the enrolled fingerprint.  This will not work if there is
- * already a fingerprint enrolled at that index.  You can use
- * GT511_CheckEnrolled() to make sure the index is available.
+ * @param command the command code, or GT511_TRACE_DATA for data packets
+ * sent to the sensor
+ * @param pStats storage for the figures
  *
- * @note Please see the sensor data sheet to understand the enrollment process.
- * There are several steps.
+ * The driver keeps figures for each command it issues, see
+ * GT511_CommandStats_t.  These can be reported by a fleet of readers to
+ * find ones that are slowing down or failing more often, for example
+ * because of a dirty sensor window or a poor cable.  The command codes
+ * are those of the GT-511C data sheet, for example 0x51 for Identify.
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * @return **GT511_ERR_NONE** if figures were returned, or
+ * **GT511_ERR_OTHER_ERROR** if the command has not been used.
  */
 GT511_Error_t
-GT511_EnrollStart(uint32_t id)
+GT511_GetCommandStats(uint16_t command, GT511_CommandStats_t *pStats)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL_START, &id);
-    return err;
+    CommandStats_t *pEntry = FindCommandStats(command, false);
+    if (!pEntry || !pStats)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    *pStats = pEntry->stats;
+    pStats->avgTicks = pEntry->avgTicks16 >> 4;
+    pStats->failRate = pEntry->failRate16 >> 4;
+    return GT511_ERR_NONE;
 }
 
 /**
- * Enroll step 1
+ * Check whether a command has drifted from a baseline.
  *
- * Enroll a captured fingerprint, first step.
+ * @param command the command code, as for GT511_GetCommandStats()
+ * @param pBaseline the expected figures for the command
+ * @param tolerance allowed increase over the baseline, in percent
+ * @param pDrifted storage for the result of the check
  *
- * @note Please see the sensor data sheet to understand the enrollment process.
- * There are several steps.
+ * The baseline would normally come from other readers of the same model
+ * and firmware, or from this reader when it was known to be working
+ * well.  The command has drifted if its average time or its failure
+ * rate is more than _tolerance_ percent above the baseline.  A failure
+ * rate is always allowed to rise by at least 1 part per thousand.
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * @return **GT511_ERR_NONE** if the check was made, or
+ * **GT511_ERR_OTHER_ERROR** if the command has not been used.
  */
 GT511_Error_t
-GT511_Enroll1(void)
+GT511_CheckCommandDrift(uint16_t command, const GT511_CommandStats_t *pBaseline,
+                        uint32_t tolerance, bool *pDrifted)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL1, NULL);
-    return err;
+    GT511_CommandStats_t stats;
+    if (!pBaseline || !pDrifted
+     || (GT511_GetCommandStats(command, &stats) != GT511_ERR_NONE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint64_t ticksLimit = ((uint64_t)pBaseline->avgTicks * (100 + tolerance)) / 100;
+    uint64_t failLimit = ((uint64_t)pBaseline->failRate * (100 + tolerance)) / 100;
+    if (failLimit <= pBaseline->failRate)
+    {
+        failLimit = pBaseline->failRate + 1;
+    }
+    *pDrifted = (stats.avgTicks > ticksLimit) || (stats.failRate > failLimit);
+    return GT511_ERR_NONE;
 }
 
 /**
- * Enroll step 2
- *
- * Enroll a captured fingerprint, second step.
- *
- * @note Please see the sensor data sheet to understand the enrollment process.
- * There are several steps.
- *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * Clear the figures for all commands.
  */
-GT511_Error_t
-GT511_Enroll2(void)
+void
+GT511_ClearCommandStats(void)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL2, NULL);
-    return err;
+    commandStatsCount = 0;
+}
+#endif
+
+#if GT511_ENABLE_STANDBY
+/*
+ * Add the time since the last change of standby state to the time spent
+ * in the current state.
+ */
+static void
+UpdatePowerStats(void)
+{
+    uint32_t now = GetTicks();
+    if (inStandby)
+    {
+        powerStats.standbyTicks += now - powerMarkTicks;
+    }
+    else
+    {
+        powerStats.activeTicks += now - powerMarkTicks;
+    }
+    powerMarkTicks = now;
 }
 
 /**
- * Enroll step 3
- *
- * Enroll a captured fingerprint, third and final step.
+ * Set up automatic standby.
  *
- * @note Please see the sensor data sheet to understand the enrollment process.
- * There are several steps.
+ * @param idleTicks time with no commands before GT511_Idle() enters
+ * standby, or 0 to never enter standby automatically
+ * @param pfnWake function checked by GT511_Idle() during standby, or NULL
+ * @param pContext application context passed to _pfnWake_
  *
- * @return **GT511_ERR_NONE** if no errors occurred.
+ * Automatic standby needs a clock, see GT511_SetClock(), which should be
+ * set first.  The idle time and the power statistics are measured from
+ * this call.
  */
-GT511_Error_t
-GT511_Enroll3(void)
+void
+GT511_SetStandby(uint32_t idleTicks, GT511_Wake_t pfnWake, void *pContext)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_ENROLL3, NULL);
-    return err;
+    standbyIdleTicks = idleTicks;
+    pfnAppWake = pfnWake;
+    pWakeContext = pContext;
+    lastCommandTicks = GetTicks();
+    powerMarkTicks = lastCommandTicks;
 }
 
 /**
- * Delete all enrolled IDs
+ * Put the reader into standby.
+ *
+ * The LED is turned off and the sensor is closed.  The LED state is
+ * saved so that GT511_Resume() can restore it, even if the LED was
+ * turned off by an earlier call that failed, unless the application has
+ * set the LED with GT511_CmosLed() since then.  No other commands should
+ * be used until the reader is resumed.  Nothing is done if the reader is
+ * already in standby.
  *
  * @return **GT511_ERR_NONE** if no errors occurred.
  */
 GT511_Error_t
-GT511_DeleteAll(void)
+GT511_Standby(void)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_DELETE_ALL, NULL);
-    return err;
+    if (inStandby)
+    {
+        return GT511_ERR_NONE;
+    }
+
+    // saved as soon as the LED is off, so that it is kept if the sensor
+    // fails to close and standby is tried again
+    if (ledOn)
+    {
+        GT511_Error_t err = GT511_CmosLed(false);
+        if (err != GT511_ERR_NONE)
+        {
+            return err;
+        }
+        standbyLedOn = true;
+    }
+    GT511_Error_t err = GT511_Close();
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    UpdatePowerStats();
+    inStandby = true;
+    ++powerStats.standbyCount;
+    return GT511_ERR_NONE;
 }
 
 /**
- * Delete specific enrolled ID
+ * Bring the reader out of standby.
  *
- * @param id index of ID to delete
+ * The sensor is opened without requesting the sensor info, and the LED
+ * is restored to its state before standby.  The time taken is recorded
+ * as the wake to ready time in the statistics.  Nothing is done if the
+ * reader is not in standby.
  *
  * @return **GT511_ERR_NONE** if no errors occurred.
  */
 GT511_Error_t
-GT511_DeleteID(uint32_t id)
+GT511_Resume(void)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_DELETE_ID, &id);
-    return err;
+    if (!inStandby)
+    {
+        return GT511_ERR_NONE;
+    }
+
+    uint32_t startTicks = GetTicks();
+    GT511_Error_t err = GT511_Open(NULL);
+    if ((err == GT511_ERR_NONE) && standbyLedOn)
+    {
+        err = GT511_CmosLed(true);
+    }
+    if (err != GT511_ERR_NONE)
+    {
+        return err;
+    }
+
+    UpdatePowerStats();
+    inStandby = false;
+    standbyLedOn = false;
+    uint32_t ticks = GetTicks() - startTicks;
+    ++powerStats.resumeCount;
+    powerStats.resumeTicks += ticks;
+    if (ticks > powerStats.maxResumeTicks)
+    {
+        powerStats.maxResumeTicks = ticks;
+    }
+    return GT511_ERR_NONE;
 }
 
 /**
- * Get the count of enrolled IDs
+ * Manage standby from the application idle loop.
  *
- * @param pEnrolledCount pointer to storage for the enrolled count
+ * @param pIsReady storage for the reader state, can be NULL
  *
- * This function will query the fingerprint reader for the total number
- * of enrollments and return the count through the *pEnrolledCount*
- * argument.  The value is only meaningful if the function return code
- * is *GT511_ERR_NONE*.
+ * This should be called regularly while the application is not using
+ * the reader.  If the reader is active and no command has been issued
+ * for the idle time set by GT511_SetStandby(), then the reader is put
+ * into standby.  If the reader is in standby and the wake function
+ * returns true, then the reader is resumed.  On return _pIsReady_ is
+ * **true** if the reader is out of standby and can be used.
  *
  * @return **GT511_ERR_NONE** if no errors occurred.
  */
 GT511_Error_t
-GT511_GetEnrollCount(uint32_t *pEnrolledCount)
+GT511_Idle(bool *pIsReady)
 {
-    uint32_t parm = 0;
-    GT511_Error_t err = IssueCommand(GT511_CMD_GET_ENROLL_COUNT, &parm);
-
-    // Read id from response parameter.  Not meaningful if err != _NONE
-    if (pEnrolledCount != NULL)
+    GT511_Error_t err = GT511_ERR_NONE;
+    if (inStandby)
     {
-        *pEnrolledCount = parm;
+        if (pfnAppWake && pfnAppWake(pWakeContext))
+        {
+            err = GT511_Resume();
+        }
+    }
+    else if (standbyIdleTicks && pfnAppGetTicks
+          && ((GetTicks() - lastCommandTicks) >= standbyIdleTicks))
+    {
+        err = GT511_Standby();
     }
 
+    if (pIsReady)
+    {
+        *pIsReady = !inStandby;
+    }
     return err;
 }
 
 /**
- * Check if a specific ID is enrolled
+ * Get the standby statistics.
  *
- * @param id index of ID to check for enrollment
- *
- * This function will query the fingerprint reader to find out if the
- * the specific ID is enrolled.
+ * @param pStats storage for the statistics
  *
- * @return **GT511_ERR_NONE** if the specified index *IS* enrolled.
- * **GT511_ERR_IS_NOT_USED** if the specified index *IS NOT* enrolled.
- * Any other return value indicates an error.
+ * The duty cycle of the reader is _activeTicks_ / (_activeTicks_ +
+ * _standbyTicks_), and the average wake to ready time is _resumeTicks_ /
+ * _resumeCount_.
  */
-GT511_Error_t
-GT511_CheckEnrolled(uint32_t id)
+void
+GT511_GetPowerStats(GT511_PowerStats_t *pStats)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_CHECK_ENROLLED, &id);
-    return err;
+    UpdatePowerStats();
+    if (pStats)
+    {
+        *pStats = powerStats;
+    }
 }
 
 /**
- * Verify fingerprint for specific ID
- *
- * @param id index of ID to verify
+ * Clear the standby statistics.
+ */
+void
+GT511_ClearPowerStats(void)
+{
+    memset(&powerStats, 0, sizeof(powerStats));
+    powerMarkTicks = GetTicks();
+}
+#endif
+
+#if GT511_ENABLE_TRACE
+/**
+ * Set the function that receives trace records.
  *
- * This function will check a fingerprint match of a specific ID.
+ * @param pfnTrace function called with each trace record, or NULL
+ * @param pContext application context passed to _pfnTrace_
  *
- * @return **GT511_ERR_NONE** if the specified index has a fingerprint
- * match.  **GT511_ERR_VERIFY_FAILED** if the specified index does not
- * match the fingerprint.  Any other return value indicates an error.
+ * Once set, _pfnTrace_ is called after every command and data packet
+ * exchanged with the sensor.  See GT511_TraceRecord_t.  Pass NULL to
+ * stop tracing.  A clock should be provided with GT511_SetClock() so
+ * that the records have meaningful times.
  */
-GT511_Error_t
-GT511_Verify(uint32_t id)
+void
+GT511_SetTrace(GT511_Trace_t pfnTrace, void *pContext)
 {
-    GT511_Error_t err = IssueCommand(GT511_CMD_VERIFY, &id);
-    return err;
+    pfnAppTrace = pfnTrace;
+    pTraceContext = pContext;
 }
 
 /**
- * Find an unused ID index.
+ * Find the time a traced exchange spent on the serial line.
  *
- * @param pId pointer to available ID index
+ * @param pRecord the trace record
+ * @param baudrate the serial baud rate
+ * @param ticksPerSecond the rate of the clock used for the trace
  *
- * Will check each ID index (slot) in sequence until an unused one is found.
- * It will return the available index number through the pointer *pId*.
+ * This counts the bytes of the command or data packet and of the
+ * response, at 10 bits per byte.  A data packet received from the sensor
+ * has a record of its own with no response, so only the packet itself is
+ * counted.  The rest of the time in the record, _endTicks_ - _startTicks_
+ * less the wire time, was spent by the sensor processing the command and
+ * by the host.
  *
- * @return **GT511_ERR_NONE** if an empty index was found.  If no empty
- * slot is found then **GT511_ERR_INVALID_POS** is returned.
+ * @return the wire time in clock ticks, or 0 if _baudrate_ is 0.
  */
-GT511_Error_t
-GT511_FindAvailable(uint32_t *pId)
+uint32_t
+GT511_TraceWireTicks(const GT511_TraceRecord_t *pRecord, uint32_t baudrate,
+                     uint32_t ticksPerSecond)
 {
-    // validate argument
-    if (!pId)
+    if (!pRecord || !baudrate)
     {
-        return GT511_ERR_OTHER_ERROR;
+        return 0;
     }
 
-    ConsolePrintf("FindAvailable()\n");
-
-    // iterate over all possible ID slots
-    for (uint32_t i = 0; i < GT511_NUM_SLOTS; i++)
+    uint64_t bytes = 0;
+    if (pRecord->command == GT511_TRACE_DATA)
     {
-        ConsolePrintf("slot %u: ", (unsigned int)i);
-
-        // check to see if this slot has an enrollment
-        uint32_t parm = i;
-        GT511_Error_t err = IssueCommand(GT511_CMD_CHECK_ENROLLED, &parm);
-
-        // if this slot is not used then return it as available
-        if (err == GT511_ERR_IS_NOT_USED)
-        {
-            ConsolePrintf("OK\n");
-            *pId = i;
-            return GT511_ERR_NONE;
-        }
-
-        // check for any other unexpected return error code
-        else if (err != GT511_ERR_NONE)
-        {
-            ConsolePrintf("ERROR: %s\n", GT511_ErrorString(err));
-            return err;
-        }
-        else
-        {
-            ConsolePrintf("IN USE\n");
-        }
+        bytes += sizeof(GT511_DataPacket_t) + pRecord->parameter + sizeof(uint16_t);
     }
-
-    // if we get here then no empty slots were found
-    return GT511_ERR_INVALID_POS;
+    else
+    {
+        bytes += sizeof(GT511_Packet_t);
+    }
+    if (!pRecord->received)
+    {
+        // the response packet
+        bytes += sizeof(GT511_Packet_t);
+    }
+    return (uint32_t)((bytes * 10 * ticksPerSecond) / baudrate);
 }
+#endif
 
-/**
- * Run the identification process.
- *
- * @param pId points to the ID index match, if any
- *
- * This function runs through all of the steps needed for fingerprint
- * identification, and returns the ID index of the match if one is found.
- * The user/app will be notified of progress as needed by calling
- * GT511_UserCallback().  For example, the callback function will be called to
- * inform the app/user when the finger should be pressed to the sensor.
- * It will be up to the application how this prompt is manifested to the
- * user.
- *
- * The following table shows how the callback is used for the various
- * steps.  In all cases, the *mode* parameter of the callback function will
- * be **GT511_MODE_IDENTIFY**.
- *
- * |callback parameter| event                                                |
- * |------------------|------------------------------------------------------|
- * | GT511_UI_PRESS   | user should press the sensor                         |
- * | GT511_UI_RELEASE | user should release the sensor                       |
- * | GT511_UI_TIMEOUT | timed out waiting for press or release               |
- * | GT511_UI_ACCEPT  | the fingerprint was identified                       |
- * | GT511_UI_REJECT  | no fingerprint match was found                       |
- * | GT511_UI_ERROR   | some error occurred (see this function return value) |
- *
- * @return **GT511_ERR_NONE** if a fingerprint match was found, in which case
- * the ID index value will be stored at *pId.  If the fingerprint was read
- * but no match was found, then **GT511_ERR_IDENTIFY_FAILED is returned.
- * Any other return value means that no match was found and may indicate
- * another kind of error.
+#if GT511_ENABLE_RUN_FLOWS
+/*
+ * Perform the steps of GT511_RunIdentify().  This is kept apart so that
+ * the commands of the process can be tagged in the trace.
  */
-GT511_Error_t
-GT511_RunIdentify(uint32_t *pId)
+static GT511_Error_t
+RunIdentifyFlow(uint32_t *pId)
 {
     GT511_Error_t err;
 
@@ -945,25 +4101,23 @@ GT511_RunIdentify(uint32_t *pId)
         return err;
     }
 
-    // Capture the fingerprint
-    err = GT511_CaptureFinger(false);
-    if (err != GT511_ERR_NONE)
+    // Capture the fingerprint and ask reader for identification
+    ConsolePrintf("identifying ...\n");
+    uint32_t id;
+    bool captured;
+    err = CaptureAndMatch(GT511_MODE_IDENTIFY, &id, &captured);
+    if (!captured)
     {
         GT511_CmosLed(false);
         ConsolePrintf("error capture finger: %s\n", GT511_ErrorString(err));
-        GT511_UserCallback(GT511_MODE_IDENTIFY, GT511_UI_ERROR);
+        PostEvent(GT511_MODE_IDENTIFY, GT511_UI_ERROR, GT511_ID_NONE);
         return err;
     }
-
-    // Ask reader for identification
-    ConsolePrintf("identifying ...\n");
-    uint32_t id;
-    err = GT511_Identify(&id);
     if (err != GT511_ERR_NONE)
     {
         GT511_CmosLed(false);
         ConsolePrintf("error identify: %s\n", GT511_ErrorString(err));
-        GT511_UserCallback(GT511_MODE_IDENTIFY, GT511_UI_REJECT);
+        PostEvent(GT511_MODE_IDENTIFY, GT511_UI_REJECT, GT511_ID_NONE);
         return err;
     }
 
@@ -988,26 +4142,27 @@ GT511_RunIdentify(uint32_t *pId)
 
     // At this point the ID was successful
     ConsolePrintf("identify ok: %u\n", (unsigned int)id);
-    GT511_UserCallback(GT511_MODE_IDENTIFY, GT511_UI_ACCEPT);
+    PostEvent(GT511_MODE_IDENTIFY, GT511_UI_ACCEPT, id);
 
     return err;
 }
 
 /**
- * Run the verification process.
+ * Run the identification process.
  *
- * @param id is the ID index to verify
+ * @param pId points to the ID index match, if any
  *
  * This function runs through all of the steps needed for fingerprint
- * verification.  The user/app will be notified of progress as needed by
- * calling GT511_UserCallback().  For example, the callback function will
- * be called to inform the app/user when the finger should be pressed to
- * the sensor.  It will be up to the application how this prompt is
- * manifested to the user.
+ * identification, and returns the ID index of the match if one is found.
+ * The user/app will be notified of progress as needed by calling
+ * GT511_UserCallback().  For example, the callback function will be called to
+ * inform the app/user when the finger should be pressed to the sensor.
+ * It will be up to the application how this prompt is manifested to the
+ * user.
  *
  * The following table shows how the callback is used for the various
  * steps.  In all cases, the *mode* parameter of the callback function will
- * be **GT511_MODE_VERIFY**.
+ * be **GT511_MODE_IDENTIFY**.
  *
  * |callback parameter| event                                                |
  * |------------------|------------------------------------------------------|
@@ -1018,13 +4173,27 @@ GT511_RunIdentify(uint32_t *pId)
  * | GT511_UI_REJECT  | no fingerprint match was found                       |
  * | GT511_UI_ERROR   | some error occurred (see this function return value) |
  *
- * @return **GT511_ERR_NONE** if the fingerprint is verified.  If the
- * fingerprint was read but does not match the specified index, then
- * **GT511_ERR_IDENTIFY_FAILED is returned.  Any other return value means
- * that no match was found and may indicate another kind of error.
+ * @return **GT511_ERR_NONE** if a fingerprint match was found, in which case
+ * the ID index value will be stored at *pId.  If the fingerprint was read
+ * but no match was found, then **GT511_ERR_IDENTIFY_FAILED is returned.
+ * Any other return value means that no match was found and may indicate
+ * another kind of error.
+ */
+GT511_Error_t
+GT511_RunIdentify(uint32_t *pId)
+{
+    BeginFlow(GT511_MODE_IDENTIFY);
+    GT511_Error_t err = RunIdentifyFlow(pId);
+    EndFlow();
+    return err;
+}
+
+/*
+ * Perform the steps of GT511_RunVerify().  This is kept apart so that
+ * the commands of the process can be tagged in the trace.
  */
-GT511_Error_t
-GT511_RunVerify(uint32_t id)
+static GT511_Error_t
+RunVerifyFlow(uint32_t id)
 {
     GT511_Error_t err;
 
@@ -1049,24 +4218,22 @@ GT511_RunVerify(uint32_t id)
         return err;
     }
 
-    // Capture the fingerprint
-    err = GT511_CaptureFinger(false);
-    if (err != GT511_ERR_NONE)
+    // Capture the fingerprint and ask reader for verification
+    ConsolePrintf("verifying ...\n");
+    bool captured;
+    err = CaptureAndMatch(GT511_MODE_VERIFY, &id, &captured);
+    if (!captured)
     {
         GT511_CmosLed(false);
         ConsolePrintf("error capture finger: %s\n", GT511_ErrorString(err));
-        GT511_UserCallback(GT511_MODE_VERIFY, GT511_UI_ERROR);
+        PostEvent(GT511_MODE_VERIFY, GT511_UI_ERROR, GT511_ID_NONE);
         return err;
     }
-
-    // Ask reader for identification
-    ConsolePrintf("verifying ...\n");
-    err = GT511_Verify(id);
     if (err != GT511_ERR_NONE)
     {
         GT511_CmosLed(false);
         ConsolePrintf("error verify: %s\n", GT511_ErrorString(err));
-        GT511_UserCallback(GT511_MODE_VERIFY, GT511_UI_REJECT);
+        PostEvent(GT511_MODE_VERIFY, GT511_UI_REJECT, id);
         return err;
     }
 
@@ -1085,44 +4252,58 @@ GT511_RunVerify(uint32_t id)
 
     // At this point the ID was successful
     ConsolePrintf("verify ok: %u\n", (unsigned int)id);
-    GT511_UserCallback(GT511_MODE_VERIFY, GT511_UI_ACCEPT);
+    PostEvent(GT511_MODE_VERIFY, GT511_UI_ACCEPT, id);
 
     return err;
 }
 
 /**
- * Run the enrollment process.
+ * Run the verification process.
  *
- * @param pId points to the ID index to use for enrollment
+ * @param id is the ID index to verify
  *
  * This function runs through all of the steps needed for fingerprint
- * enrollment using the ID index specified through *pId*.
- * The user/app will be notified of progress as needed by calling
- * GT511_UserCallback().  For example, the callback function will be called to
- * inform the app/user when the finger should be pressed to the sensor.
- * It will be up to the application how this prompt is manifested to the
- * user.
+ * verification.  The user/app will be notified of progress as needed by
+ * calling GT511_UserCallback().  For example, the callback function will
+ * be called to inform the app/user when the finger should be pressed to
+ * the sensor.  It will be up to the application how this prompt is
+ * manifested to the user.
  *
  * The following table shows how the callback is used for the various
  * steps.  In all cases, the *mode* parameter of the callback function will
- * be **GT511_MODE_ENROLL**.
+ * be **GT511_MODE_VERIFY**.
  *
  * |callback parameter| event                                                |
  * |------------------|------------------------------------------------------|
  * | GT511_UI_PRESS   | user should press the sensor                         |
  * | GT511_UI_RELEASE | user should release the sensor                       |
  * | GT511_UI_TIMEOUT | timed out waiting for press or release               |
- * | GT511_UI_ACCEPT  | the fingerprint was enrolled                         |
- * | GT511_UI_REJECT  | the fingerprint was not enrolled                     |
+ * | GT511_UI_ACCEPT  | the fingerprint was identified                       |
+ * | GT511_UI_REJECT  | no fingerprint match was found                       |
  * | GT511_UI_ERROR   | some error occurred (see this function return value) |
  *
- * @return **GT511_ERR_NONE** if the fingerprint was enrolled.  If the
- * fingerprint was not enrolled for some reason, then **GT511_ERR_ENROLL_FAILED
- * is returned.  Any other return value means that there was no enrollment
- * due to another kind of error.
+ * @return **GT511_ERR_NONE** if the fingerprint is verified.  If the
+ * fingerprint was read but does not match the specified index, then
+ * **GT511_ERR_IDENTIFY_FAILED is returned.  Any other return value means
+ * that no match was found and may indicate another kind of error.
  */
 GT511_Error_t
-GT511_RunEnroll(uint32_t *pId)
+GT511_RunVerify(uint32_t id)
+{
+    BeginFlow(GT511_MODE_VERIFY);
+    GT511_Error_t err = RunVerifyFlow(id);
+    EndFlow();
+    return err;
+}
+
+/*
+ * Perform the steps of GT511_RunEnroll().  This is kept apart so that
+ * the commands of the process can be tagged in the trace.  The accept
+ * event is left to the caller, which may have more to do before the
+ * enrollment is complete.
+ */
+static GT511_Error_t
+RunEnrollFlow(uint32_t *pId)
 {
     if (!pId)
     {
@@ -1135,7 +4316,7 @@ GT511_RunEnroll(uint32_t *pId)
     GT511_Error_t err = GT511_FindAvailable(pId);
     if (err != GT511_ERR_NONE)
     {
-        GT511_UserCallback(GT511_MODE_ENROLL, GT511_UI_ERROR);
+        PostEvent(GT511_MODE_ENROLL, GT511_UI_ERROR, GT511_ID_NONE);
         ConsolePrintf("no available slots for enrollment\n");
         return err;
     }
@@ -1171,12 +4352,12 @@ GT511_RunEnroll(uint32_t *pId)
         }
 
         // Capture the fingerprint
-        err = GT511_CaptureFinger(true);
+        err = CaptureFinger(GT511_MODE_ENROLL, true);
         if (err != GT511_ERR_NONE)
         {
             GT511_CmosLed(false);
             ConsolePrintf("error capture finger: %s\n", GT511_ErrorString(err));
-            GT511_UserCallback(GT511_MODE_ENROLL, GT511_UI_ERROR);
+            PostEvent(GT511_MODE_ENROLL, GT511_UI_ERROR, GT511_ID_NONE);
             return err;
         }
 
@@ -1196,7 +4377,7 @@ GT511_RunEnroll(uint32_t *pId)
         }
         if (err != GT511_ERR_NONE)
         {
-            GT511_UserCallback(GT511_MODE_ENROLL, GT511_UI_REJECT);
+            PostEvent(GT511_MODE_ENROLL, GT511_UI_REJECT, *pId);
             ConsolePrintf("enrollment failed at step %u, err=%s\n",
                           (unsigned int)step, GT511_ErrorString(err));
             GT511_CmosLed(false);
@@ -1219,10 +4400,416 @@ GT511_RunEnroll(uint32_t *pId)
 
     // At this point the enroll was successful
     ConsolePrintf("enroll ok: %u\n", (unsigned int)*pId);
-    GT511_UserCallback(GT511_MODE_ENROLL, GT511_UI_ACCEPT);
 
     return GT511_ERR_NONE;
 }
 
+/**
+ * Run the enrollment process.
+ *
+ * @param pId points to the ID index to use for enrollment
+ *
+ * This function runs through all of the steps needed for fingerprint
+ * enrollment using the ID index specified through *pId*.
+ * The user/app will be notified of progress as needed by calling
+ * GT511_UserCallback().  For example, the callback function will be called to
+ * inform the app/user when the finger should be pressed to the sensor.
+ * It will be up to the application how this prompt is manifested to the
+ * user.
+ *
+ * The following table shows how the callback is used for the various
+ * steps.  In all cases, the *mode* parameter of the callback function will
+ * be **GT511_MODE_ENROLL**.
+ *
+ * |callback parameter| event                                                |
+ * |------------------|------------------------------------------------------|
+ * | GT511_UI_PRESS   | user should press the sensor                         |
+ * | GT511_UI_RELEASE | user should release the sensor                       |
+ * | GT511_UI_TIMEOUT | timed out waiting for press or release               |
+ * | GT511_UI_ACCEPT  | the fingerprint was enrolled                         |
+ * | GT511_UI_REJECT  | the fingerprint was not enrolled                     |
+ * | GT511_UI_ERROR   | some error occurred (see this function return value) |
+ *
+ * @return **GT511_ERR_NONE** if the fingerprint was enrolled.  If the
+ * fingerprint was not enrolled for some reason, then **GT511_ERR_ENROLL_FAILED
+ * is returned.  Any other return value means that there was no enrollment
+ * due to another kind of error.
+ */
+GT511_Error_t
+GT511_RunEnroll(uint32_t *pId)
+{
+    BeginFlow(GT511_MODE_ENROLL);
+    GT511_Error_t err = RunEnrollFlow(pId);
+    if (err == GT511_ERR_NONE)
+    {
+        PostEvent(GT511_MODE_ENROLL, GT511_UI_ACCEPT, *pId);
+    }
+    EndFlow();
+    return err;
+}
+
+#if GT511_ENABLE_TEMPLATE_IO
+/**
+ * Run the enrollment process and return the new template.
+ *
+ * @param pId points to the ID index used for enrollment
+ * @param pTemplate storage for the template of the new enrollment
+ * @param size number of bytes of storage at _pTemplate_
+ *
+ * This runs GT511_RunEnroll() and then reads the template of the new
+ * enrollment into _pTemplate_, which must be at least
+ * GT511_TEMPLATE_SIZE bytes.  This is meant for an enrollment station.
+ * The application keeps the template as the master copy and stores it
+ * in each of the other readers with GT511_SetTemplate(), instead of
+ * enrolling the person again at every reader.  The buffer is checked
+ * before the enrollment starts so that the user is not asked to enroll
+ * if the template cannot be returned.  The callbacks are as for
+ * GT511_RunEnroll(), except that GT511_UI_ACCEPT is only given once the
+ * template has been read.  If the template cannot be read then
+ * GT511_UI_ERROR is given instead.
+ *
+ * @return **GT511_ERR_NONE** if the fingerprint was enrolled and the
+ * template was read.  If the template could not be read then the error
+ * is returned but the enrollment remains at _*pId_.  Any other value is
+ * as for GT511_RunEnroll().
+ */
+GT511_Error_t
+GT511_RunEnrollTemplate(uint32_t *pId, uint8_t *pTemplate, uint32_t size)
+{
+    if (!pId || !pTemplate || (size < GT511_TEMPLATE_SIZE))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    // the template is read as part of the same enrollment flow, and the
+    // user is only told of success once the template is read
+    BeginFlow(GT511_MODE_ENROLL);
+    GT511_Error_t err = RunEnrollFlow(pId);
+    if (err == GT511_ERR_NONE)
+    {
+        err = GT511_GetTemplate(*pId, pTemplate, size);
+        if (err == GT511_ERR_NONE)
+        {
+            PostEvent(GT511_MODE_ENROLL, GT511_UI_ACCEPT, *pId);
+        }
+        else
+        {
+            ConsolePrintf("error reading enrolled template: %s\n", GT511_ErrorString(err));
+            PostEvent(GT511_MODE_ENROLL, GT511_UI_ERROR, *pId);
+        }
+    }
+    EndFlow();
+    return err;
+}
+#endif
+
+/**
+ * Set the press/release confirmation for a mode.
+ *
+ * @param mode the driver mode that the settings apply to
+ * @param pDebounce points at the new confirmation settings
+ *
+ * The settings are used by the enroll, identify and verify processes
+ * while waiting for the user to press or release the sensor.  A stricter
+ * setting avoids captures of a partial placement at the cost of some
+ * added latency.  The _windowCount_ must be between 1 and 32, and
+ * _dwellCount_ and _confirmCount_ must be between 1 and _windowCount_.
+ * The defaults are set by GT511_DEBOUNCE_ENROLL and
+ * GT511_DEBOUNCE_IDENTIFY.
+ *
+ * @return **GT511_ERR_NONE** if the settings were accepted, or
+ * **GT511_ERR_OTHER_ERROR** if any argument is invalid.
+ */
+GT511_Error_t
+GT511_SetDebounce(GT511_Mode_t mode, const GT511_Debounce_t *pDebounce)
+{
+    if ((mode >= NUM_MODES) || !pDebounce)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    uint8_t window = pDebounce->windowCount;
+    if ((window < 1) || (window > 32)
+     || (pDebounce->confirmCount < 1) || (pDebounce->confirmCount > window)
+     || (pDebounce->dwellCount < 1) || (pDebounce->dwellCount > window))
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    debounce[mode] = *pDebounce;
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Get the press/release confirmation for a mode.
+ *
+ * @param mode the driver mode to query
+ * @param pDebounce storage for the returned settings
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetDebounce(GT511_Mode_t mode, GT511_Debounce_t *pDebounce)
+{
+    if ((mode >= NUM_MODES) || !pDebounce)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    *pDebounce = debounce[mode];
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Set the interval between polls of the sensor.
+ *
+ * @param ticks the number of clock ticks to wait between polls
+ *
+ * While waiting for a finger press or release the driver polls the
+ * sensor.  By default it polls continuously.  Setting an interval
+ * reduces the load on the serial port and host processor.  Polls are
+ * aligned to multiples of the interval on the application clock so that
+ * wakeups for sensors sharing a clock are batched together.  This only
+ * has an effect if a sleep function was provided with GT511_SetClock().
+ */
+void
+GT511_SetPollInterval(uint32_t ticks)
+{
+    pollInterval = ticks;
+}
+
+/**
+ * Set the driver timeout for waiting on a press or release.
+ *
+ * @param mode the driver mode that the timeout applies to
+ * @param ticks the timeout in clock ticks, or 0 for no driver timeout
+ *
+ * The driver timeout is checked together with the application timeout
+ * from GT511_CheckTimeout(), and a wait ends when either expires.  It
+ * lets an application that provides a clock with GT511_SetClock() leave
+ * the timeout to the driver instead of keeping its own deadline for
+ * every wait.  It has no effect without a clock.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_SetWaitTimeout(GT511_Mode_t mode, uint32_t ticks)
+{
+    if (mode >= NUM_MODES)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    waitTimeout[mode] = ticks;
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Set whether identification and verification retry at high quality.
+ *
+ * @param enable true to start with a fast capture and retry at high
+ * quality, or false to use only fast captures
+ *
+ * GT511_RunIdentify() and GT511_RunVerify() start with a fast capture,
+ * which is enough for most fingers.  With escalation enabled, a bad
+ * fingerprint is captured again at high quality while the finger is
+ * still on the sensor, which is slower but can read difficult fingers.
+ * A rejected match is never retried within the same touch, so a finger
+ * still gets only one match per presentation, but the next attempt
+ * starts with a high quality capture.  IDs that only match at high
+ * quality are remembered, and GT511_RunVerify() goes straight to a high
+ * quality capture for them.  The default is set by
+ * GT511_CAPTURE_ESCALATION.  The effect on time to unlock can be seen
+ * in the statistics from GT511_GetPressStats().
+ */
+void
+GT511_SetCaptureEscalation(bool enable)
+{
+    captureEscalation = enable;
+}
+
+#if GT511_ENABLE_STATS
+/**
+ * Get press detection and capture statistics for a mode.
+ *
+ * @param mode the driver mode to query
+ * @param pStats storage for the returned statistics
+ *
+ * The statistics can be used to choose the debounce settings for a site.
+ * The capture failure rate is _captureFailCount_ / _captureCount_, and
+ * the latency added by press confirmation is _extraPolls_ / _pressCount_
+ * polls of the sensor per press.  The average capture time is
+ * _captureTicks_ / _captureCount_, and for high quality captures is
+ * _highQualityTicks_ / _highQualityCount_.  The reject rate is
+ * _rejectCount_ / _matchCount_, where each presentation of a finger is
+ * matched and counted once.
+ *
+ * @return **GT511_ERR_NONE** if no errors occurred.
+ */
+GT511_Error_t
+GT511_GetPressStats(GT511_Mode_t mode, GT511_PressStats_t *pStats)
+{
+    if ((mode >= NUM_MODES) || !pStats)
+    {
+        return GT511_ERR_OTHER_ERROR;
+    }
+
+    *pStats = pressStats[mode];
+    return GT511_ERR_NONE;
+}
+
+/**
+ * Clear the press detection and capture statistics for all modes.
+ */
+void
+GT511_ClearPressStats(void)
+{
+    memset(pressStats, 0, sizeof(pressStats));
+}
+#endif
+
+#if GT511_ENABLE_EVENT_QUEUE
+/**
+ * Enable or disable the event queue.
+ *
+ * @param enable true to queue events, false to use the callback
+ * @param overflow what to do with a new event when the queue is full
+ *
+ * While the queue is enabled, driver events are placed in a queue to be
+ * taken by GT511_GetEvent() instead of being passed to
+ * GT511_UserCallback().  The driver never waits for room in the queue.
+ * If the queue is full then the new event is either dropped, or passed
+ * to GT511_UserCallback(), depending on _overflow_.  Any events already
+ * in the queue are discarded.  This should only be called when the
+ * driver is idle.
+ */
+void
+GT511_SetEventQueue(bool enable, GT511_Overflow_t overflow)
+{
+    eventQueueEnabled = false;
+    eventTail = eventHead;
+    eventOverflow = overflow;
+    eventQueueEnabled = enable;
+}
+
+/**
+ * Take the next event from the event queue.
+ *
+ * @param pEvent storage for the event
+ *
+ * This is called by the application to receive driver events when the
+ * event queue is enabled (see GT511_SetEventQueue()).  It does not wait,
+ * and it can be called from a different thread than the one using the
+ * driver, as long as only one thread takes events.
+ *
+ * @return **true** if an event was returned, or **false** if the queue
+ * is empty.
+ */
+bool
+GT511_GetEvent(GT511_Event_t *pEvent)
+{
+    uint32_t tail = eventTail;
+    if (!pEvent || (tail == eventHead))
+    {
+        return false;
+    }
+
+    EventBarrier();
+    *pEvent = eventQueue[tail % GT511_EVENT_QUEUE_SIZE];
+    EventBarrier();
+    eventTail = tail + 1;
+
+    uint32_t latency = GetTicks() - pEvent->postTicks;
+    ++eventStats.deliveredCount;
+    eventStats.latencyTicks += latency;
+    if (latency > eventStats.maxLatencyTicks)
+    {
+        eventStats.maxLatencyTicks = latency;
+    }
+    return true;
+}
+
+/**
+ * Get the event queue statistics.
+ *
+ * @param pStats storage for the statistics
+ *
+ * The average time an event waits for the application is
+ * _latencyTicks_ / _deliveredCount_.  A non-zero _overflowCount_ means
+ * the queue is too small for how quickly the application takes events.
+ */
+void
+GT511_GetEventStats(GT511_EventStats_t *pStats)
+{
+    if (pStats)
+    {
+        *pStats = eventStats;
+    }
+}
+
+/**
+ * Clear the event queue statistics.
+ */
+void
+GT511_ClearEventStats(void)
+{
+    memset(&eventStats, 0, sizeof(eventStats));
+}
+#endif
+#endif
+
+#ifdef GT511_FAULT_INJECTION
+/**
+ * Set up fault injection.
+ *
+ * @param pConfig points at the fault settings, or NULL to stop injecting
+ *
+ * Faults are injected into messages received from the sensor according
+ * to the rates in _pConfig_.  The schedule is repeatable for the same
+ * seed, so that a test run against a simulated sensor can be repeated.
+ * Stalls require a sleep function to be provided with GT511_SetClock().
+ * This also clears the fault statistics.
+ *
+ * @note Only available if the driver is built with GT511_FAULT_INJECTION.
+ */
+void
+GT511_SetFaultInjection(const GT511_FaultConfig_t *pConfig)
+{
+    if (pConfig)
+    {
+        faultConfig = *pConfig;
+    }
+    else
+    {
+        memset(&faultConfig, 0, sizeof(faultConfig));
+    }
+    faultRandom = faultConfig.seed;
+    faultPending = false;
+    faultHeldCount = 0;
+    memset(&faultStats, 0, sizeof(faultStats));
+}
+
+/**
+ * Get fault injection statistics.
+ *
+ * @param pStats storage for the returned statistics
+ *
+ * The mean time to recover is _recoveryTicks_ / _recoveryCount_, and the
+ * mean number of failed commands per fault is _failedCount_ /
+ * _faultCount_.  The throughput lost to faults is _failedCount_ /
+ * _commandCount_.
+ *
+ * @note Only available if the driver is built with GT511_FAULT_INJECTION.
+ */
+void
+GT511_GetFaultStats(GT511_FaultStats_t *pStats)
+{
+    if (pStats)
+    {
+        *pStats = faultStats;
+    }
+}
+#endif
+
 /** @} */
 
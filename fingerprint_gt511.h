@@ -19,11 +19,98 @@
 extern "C" {
 #endif
 
+/*
+ * Feature selection.  Each group of driver features can be left out of
+ * the build by defining the macro to 0 on the compiler command line.
+ * The same settings must be used when compiling the driver and the
+ * application.
+ */
+
+// Enroll, identify and verify processes (GT511_RunEnroll() etc)
+#ifndef GT511_ENABLE_RUN_FLOWS
+#define GT511_ENABLE_RUN_FLOWS 1
+#endif
+
+// Template upload and download (GT511_GetTemplate() etc)
+#ifndef GT511_ENABLE_TEMPLATE_IO
+#define GT511_ENABLE_TEMPLATE_IO 1
+#endif
+
+// Fingerprint image download (GT511_GetImage() etc)
+#ifndef GT511_ENABLE_IMAGE_IO
+#define GT511_ENABLE_IMAGE_IO 1
+#endif
+
+// Sensor info data packet from GT511_Open()
+#ifndef GT511_ENABLE_INFO
+#define GT511_ENABLE_INFO 1
+#endif
+
+// Driver statistics (GT511_GetPressStats() etc)
+#ifndef GT511_ENABLE_STATS
+#define GT511_ENABLE_STATS 1
+#endif
+
+// Error code names returned by GT511_ErrorString()
+#ifndef GT511_ENABLE_ERROR_STRINGS
+#define GT511_ENABLE_ERROR_STRINGS 1
+#endif
+
+// Command tracing through GT511_SetTrace()
+#ifndef GT511_ENABLE_TRACE
+#define GT511_ENABLE_TRACE 1
+#endif
+
+// Queued delivery of driver events (GT511_GetEvent() etc)
+#ifndef GT511_ENABLE_EVENT_QUEUE
+#define GT511_ENABLE_EVENT_QUEUE 1
+#endif
+
+// Low power standby (GT511_Standby() etc)
+#ifndef GT511_ENABLE_STANDBY
+#define GT511_ENABLE_STANDBY 1
+#endif
+
 /**
  * @addtogroup gt511_driver
  * @{
  */
 
+/**
+ * Set the number of supported fingerprint slots.
+ * This should match the capability of your sensor hardware.
+ */
+#ifndef GT511_NUM_SLOTS
+#define GT511_NUM_SLOTS 20
+#endif
+
+/**
+ * Size in bytes of a fingerprint template.  Refer to GT511_GetTemplate().
+ */
+#define GT511_TEMPLATE_SIZE 498
+
+/**
+ * Dimensions of the fingerprint image returned by GT511_GetImage().
+ * The image is 8 bits per pixel.
+ */
+#define GT511_IMAGE_WIDTH 258
+#define GT511_IMAGE_HEIGHT 202
+#define GT511_IMAGE_SIZE (GT511_IMAGE_WIDTH * GT511_IMAGE_HEIGHT)
+
+/**
+ * Dimensions of the raw image returned by GT511_GetRawImage().
+ * The image is 8 bits per pixel.
+ */
+#define GT511_RAW_IMAGE_WIDTH 160
+#define GT511_RAW_IMAGE_HEIGHT 120
+#define GT511_RAW_IMAGE_SIZE (GT511_RAW_IMAGE_WIDTH * GT511_RAW_IMAGE_HEIGHT)
+
+/**
+ * ID value used to indicate that there was no match.  Refer to
+ * GT511_IdentifyTemplateBatch().
+ */
+#define GT511_ID_NONE 0xFFFFFFFF
+
 /**
  * Possible error codes that can be returned by the GT-511C driver API
  * functions.  Most of these map directly to errors produced by the hardware
@@ -132,6 +219,45 @@ typedef enum
     GT511_UI_ERROR,     ///< processing error occurred
 } GT511_UserInfo_t;
 
+/**
+ * A driver event held in the event queue.  Refer to GT511_GetEvent().
+ *
+ * An accept or reject event carries the ID that was identified, verified
+ * or enrolled, when it is known, so that the application can keep an
+ * access log from the queue without slowing down the driver.
+ */
+typedef struct
+{
+    GT511_Mode_t mode;      ///< processing mode of the driver
+    GT511_UserInfo_t ui;    ///< the user event or notification
+    uint32_t id;            ///< ID the event is about, or GT511_ID_NONE
+    uint16_t deviceId;      ///< device ID of the sensor
+    uint32_t postTicks;     ///< time the event was posted by the driver
+} GT511_Event_t;
+
+/**
+ * What the driver does with an event when the event queue is full.
+ * Refer to GT511_SetEventQueue().
+ */
+typedef enum
+{
+    GT511_OVERFLOW_DROP,        ///< discard the new event
+    GT511_OVERFLOW_CALLBACK,    ///< deliver the event by GT511_UserCallback()
+} GT511_Overflow_t;
+
+/**
+ * Event queue statistics.  Refer to GT511_GetEventStats().
+ */
+typedef struct
+{
+    uint32_t postedCount;       ///< events placed in the queue
+    uint32_t overflowCount;     ///< events that found the queue full
+    uint32_t highWater;         ///< most events held in the queue at once
+    uint32_t deliveredCount;    ///< events taken from the queue
+    uint32_t latencyTicks;      ///< total time events spent in the queue
+    uint32_t maxLatencyTicks;   ///< longest time an event spent in the queue
+} GT511_EventStats_t;
+
 /**
  * Notify the application/user of a driver event (implemented by application)
  *
@@ -178,6 +304,288 @@ extern void GT511_SetTimeout(GT511_Mode_t mode);
  */
 extern bool GT511_CheckTimeout(GT511_Mode_t mode);
 
+/**
+ * Read the current time (optionally provided by application).
+ *
+ * The driver uses this to measure latencies and to pace its polling of
+ * the sensor.  The tick period is chosen by the application (typically
+ * milliseconds) and the value is allowed to wrap.  The clock does not
+ * need to be wall-clock time.  A simulation can supply a virtual clock
+ * that it advances itself, so that the driver runs faster than real time.
+ * Refer to GT511_SetClock().
+ *
+ * @return the current time in ticks.
+ */
+typedef uint32_t (*GT511_GetTicks_t)(void);
+
+/**
+ * Wait for a number of clock ticks (optionally provided by application).
+ *
+ * @param ticks the number of ticks to wait
+ *
+ * The driver calls this between polls of the sensor when a poll interval
+ * is set with GT511_SetPollInterval().  The application can sleep, enter
+ * a low power mode, or just advance a virtual clock.
+ */
+typedef void (*GT511_Sleep_t)(uint32_t ticks);
+
+/**
+ * Provide the next piece of a template (implemented by application).
+ *
+ * @param pContext the application context passed to the driver
+ * @param pData storage for the next piece of the template
+ * @param length number of bytes to provide
+ *
+ * Used by GT511_SetTemplateStream() to get a template a few bytes at a
+ * time, for example while it is decompressed from storage.
+ *
+ * @return **true** if the bytes were provided, or **false** to abandon
+ * the transfer.
+ */
+typedef bool (*GT511_ReadData_t)(void *pContext, uint8_t *pData, uint32_t length);
+
+/**
+ * Accept the next piece of a template (implemented by application).
+ *
+ * @param pContext the application context passed to the driver
+ * @param pData points at the next piece of the template
+ * @param length number of bytes at _pData_
+ *
+ * Used by GT511_GetTemplateStream() to pass a template to the
+ * application a few bytes at a time as it is received.
+ *
+ * @return **true** to continue, or **false** to abandon the transfer.
+ */
+typedef bool (*GT511_WriteData_t)(void *pContext, const uint8_t *pData, uint32_t length);
+
+/**
+ * Check if a long running operation should stop (implemented by
+ * application).
+ *
+ * @param pContext the application context passed to the driver
+ *
+ * Used by GT511_IdentifyTemplateBatch() so that the application can take
+ * the reader back, for example when a person wants to use it.
+ *
+ * @return **true** to stop the operation.
+ */
+typedef bool (*GT511_Preempt_t)(void *pContext);
+
+/**
+ * Select the serial port of one of a group of sensors (implemented by
+ * application).
+ *
+ * @param pContext the application context passed to the driver
+ * @param shard the number of the sensor, counting from 0
+ *
+ * Used by GT511_IdentifyTemplateShards() before it talks to each sensor,
+ * so that GT511_SendMessage() and GT511_ReceiveMessage() use its port.
+ */
+typedef void (*GT511_SelectShard_t)(void *pContext, uint32_t shard);
+
+/**
+ * Command value used in a trace record for a data packet sent to or
+ * received from the sensor.  Refer to GT511_TraceRecord_t.
+ */
+#define GT511_TRACE_DATA 0
+
+/**
+ * Record of one exchange with the sensor, passed to the trace function.
+ * Refer to GT511_SetTrace().
+ *
+ * For a data packet, such as a template, _command_ is GT511_TRACE_DATA
+ * and _parameter_ is the number of payload bytes.  A data packet sent to
+ * the sensor is answered with a response in the same way as a command.
+ * A data packet received from the sensor has _received_ set and no
+ * response, and its record follows the record of the command that asked
+ * for it.  The times are measured with the clock provided by
+ * GT511_SetClock().
+ *
+ * Commands issued by a process such as GT511_RunIdentify() are tagged
+ * with the mode of the process and a flow number, which is the same for
+ * all commands of one run of the process.  Commands issued directly by
+ * the application have mode GT511_MODE_IDLE and flow 0.  The sequence
+ * number counts the records passed to the trace function, so that they
+ * can be put back in order if the application logs them in different
+ * places.  It does not move while no trace function is set.
+ */
+typedef struct
+{
+    uint16_t command;       ///< command code sent to the sensor
+    bool received;          ///< data packet was received from the sensor
+    uint32_t parameter;     ///< command parameter sent to the sensor
+    uint32_t response;      ///< response parameter, if there was an ACK
+    GT511_Error_t err;      ///< result of the exchange
+    uint32_t startTicks;    ///< time the command was sent
+    uint32_t endTicks;      ///< time the response was received
+    uint32_t sequence;      ///< record number, counting from 1
+    uint16_t deviceId;      ///< device ID of the sensor
+    GT511_Mode_t mode;      ///< process the command is part of
+    uint32_t flow;          ///< run of the process, or 0 for none
+} GT511_TraceRecord_t;
+
+/**
+ * Receive a trace record (implemented by application).
+ *
+ * @param pContext the application context passed to GT511_SetTrace()
+ * @param pRecord the record of the exchange with the sensor
+ *
+ * This is called from the driver after each exchange with the sensor, so
+ * it should return quickly, for example by copying the record to a
+ * buffer or log.
+ */
+typedef void (*GT511_Trace_t)(void *pContext, const GT511_TraceRecord_t *pRecord);
+
+/**
+ * Check whether the reader should wake from standby (implemented by
+ * application).
+ *
+ * @param pContext the application context passed to GT511_SetStandby()
+ *
+ * This is called by GT511_Idle() while the reader is in standby.  It
+ * would normally check an external wake source such as a proximity
+ * sensor, a button or a timer for a slow periodic check.
+ *
+ * @return **true** to wake the reader.
+ */
+typedef bool (*GT511_Wake_t)(void *pContext);
+
+/**
+ * Standby statistics.  Refer to GT511_GetPowerStats().
+ */
+typedef struct
+{
+    uint32_t standbyCount;      ///< number of times standby was entered
+    uint32_t standbyTicks;      ///< total time spent in standby
+    uint32_t activeTicks;       ///< total time spent out of standby
+    uint32_t resumeCount;       ///< number of times the reader was resumed
+    uint32_t resumeTicks;       ///< total time from wake to ready
+    uint32_t maxResumeTicks;    ///< longest time from wake to ready
+} GT511_PowerStats_t;
+
+/**
+ * Size in bytes of a template hash.  Refer to GT511_HashTemplate().
+ */
+#define GT511_HASH_SIZE 16
+
+/**
+ * Hash of a fingerprint template, the first GT511_HASH_SIZE bytes of its
+ * SHA-256 digest.  Hashes are compared with memcmp().
+ */
+typedef struct
+{
+    uint8_t bytes[GT511_HASH_SIZE];
+} GT511_Hash_t;
+
+/**
+ * State the driver keeps about the selected sensor.  Refer to
+ * GT511_SaveState().
+ *
+ * The contents are only meaningful to the driver.  The structure holds
+ * no pointers, so it can be copied between processes or stored, but it
+ * can only be restored by a driver built with the same number of slots
+ * and the same GT511_ENABLE_RUN_FLOWS, GT511_ENABLE_TEMPLATE_IO and
+ * GT511_ENABLE_STANDBY settings.
+ */
+typedef struct
+{
+    uint32_t size;          ///< size of the structure, to catch mismatched builds
+    uint32_t features;      ///< feature groups that saved the state
+    uint16_t deviceId;      ///< device ID of the sensor
+    bool ledOn;             ///< backlight state
+    bool inStandby;         ///< sensor is in standby
+    bool standbyLedOn;      ///< backlight state to restore on resume
+    uint32_t preferHighQuality[(GT511_NUM_SLOTS + 31) / 32]; ///< IDs that need high quality captures
+    uint32_t templateHashValid[(GT511_NUM_SLOTS + 31) / 32]; ///< IDs with a known template hash
+    GT511_Hash_t templateHash[GT511_NUM_SLOTS]; ///< template hash of each ID
+} GT511_DeviceState_t;
+
+/**
+ * Settings used to confirm a finger press or release.
+ *
+ * While waiting for a press or release the driver keeps a history of the
+ * most recent sensor polls.  The press (or release) is only accepted when
+ * at least _confirmCount_ of the last _windowCount_ polls agree, and the
+ * last _dwellCount_ polls in a row agree.  This filters out grazing
+ * touches that would otherwise lead to a poor capture.  Setting all three
+ * values to 1 accepts the first poll that agrees.
+ */
+typedef struct
+{
+    uint8_t confirmCount;   ///< polls that must agree within the window (K)
+    uint8_t windowCount;    ///< number of recent polls considered, 1-32 (N)
+    uint8_t dwellCount;     ///< consecutive agreeing polls needed at the end
+} GT511_Debounce_t;
+
+/**
+ * Press detection and capture statistics, kept separately for each mode.
+ * Refer to GT511_GetPressStats().
+ */
+typedef struct
+{
+    uint32_t pressCount;        ///< number of confirmed presses
+    uint32_t extraPolls;        ///< polls spent confirming after first touch
+    uint32_t extraTicks;        ///< clock ticks spent confirming after first touch
+    uint32_t captureCount;      ///< number of captures attempted
+    uint32_t captureFailCount;  ///< number of captures that failed
+    uint32_t captureTicks;      ///< total time spent capturing
+    uint32_t highQualityCount;  ///< number of high quality captures
+    uint32_t highQualityTicks;  ///< total time spent on high quality captures
+    uint32_t matchCount;        ///< number of presentations matched
+    uint32_t rejectCount;       ///< number of presentations rejected
+    uint32_t escalationCount;   ///< escalations to a high quality capture
+} GT511_PressStats_t;
+
+/**
+ * Rolling performance figures for one command.  Refer to
+ * GT511_GetCommandStats().
+ *
+ * The averages are exponentially weighted, so recent commands count the
+ * most.  A command fails if there is a communication error or the
+ * sensor reports GT511_ERR_BAD_FINGER.
+ */
+typedef struct
+{
+    uint32_t count;             ///< number of times the command was issued
+    uint32_t failCount;         ///< number of times the command failed
+    uint32_t nackCount;         ///< number of other NACK responses
+    uint32_t avgTicks;          ///< average time to complete the command
+    uint32_t maxTicks;          ///< longest time to complete the command
+    uint32_t failRate;          ///< average failure rate, parts per thousand
+} GT511_CommandStats_t;
+
+#ifdef GT511_FAULT_INJECTION
+/**
+ * Fault injection settings.  Each rate is the chance, in parts per
+ * thousand, that the fault is applied to a message received from the
+ * sensor.  Refer to GT511_SetFaultInjection().
+ */
+typedef struct
+{
+    uint32_t seed;          ///< seed for the fault schedule
+    uint16_t dropRate;      ///< drop one byte from the message
+    uint16_t garbageRate;   ///< insert noise bytes ahead of the message
+    uint16_t bitFlipRate;   ///< flip one bit in the message
+    uint16_t truncateRate;  ///< cut the message short
+    uint16_t stallRate;     ///< stall before the message is received
+    uint32_t stallTicks;    ///< maximum stall time in clock ticks
+} GT511_FaultConfig_t;
+
+/**
+ * Fault injection statistics.  These measure how well the driver recovers
+ * from communication faults.  Refer to GT511_GetFaultStats().
+ */
+typedef struct
+{
+    uint32_t faultCount;        ///< number of faults injected
+    uint32_t commandCount;      ///< number of commands issued
+    uint32_t failedCount;       ///< commands that failed while recovering
+    uint32_t recoveryCount;     ///< number of recoveries from faults
+    uint32_t recoveryTicks;     ///< total time from fault to recovery
+    uint32_t maxRecoveryTicks;  ///< longest time from fault to recovery
+} GT511_FaultStats_t;
+#endif
+
 /** @} */
 
 // Remaining function prototypes.  These are documented in the .c file.
@@ -186,6 +594,7 @@ extern GT511_Error_t GT511_Open(GT511_Info_t *pInfo);
 extern GT511_Error_t GT511_Close(void);
 extern GT511_Error_t GT511_CmosLed(bool on);
 extern GT511_Error_t GT511_IsPressFinger(bool *pIsPressed);
+extern GT511_Error_t GT511_IsPressFingerCached(bool *pIsPressed, uint32_t maxAge);
 extern GT511_Error_t GT511_CaptureFinger(bool highQuality);
 extern GT511_Error_t GT511_Identify(uint32_t *pId);
 extern GT511_Error_t GT511_Verify(uint32_t id);
@@ -195,22 +604,88 @@ extern GT511_Error_t GT511_Enroll2(void);
 extern GT511_Error_t GT511_Enroll3(void);
 extern GT511_Error_t GT511_DeleteID(uint32_t id);
 extern GT511_Error_t GT511_DeleteAll(void);
+extern GT511_Error_t GT511_RevokeID(uint32_t id, uint32_t *pTicks);
 extern GT511_Error_t GT511_GetEnrollCount(uint32_t *pEnrolledCount);
 extern GT511_Error_t GT511_CheckEnrolled(uint32_t id);
 extern GT511_Error_t GT511_FindAvailable(uint32_t *pId);
+extern void GT511_SetClock(GT511_GetTicks_t pfnGetTicks, GT511_Sleep_t pfnSleep);
+extern void GT511_SetDeviceId(uint16_t id);
+extern uint16_t GT511_GetDeviceId(void);
+extern void GT511_SaveState(GT511_DeviceState_t *pState);
+extern GT511_Error_t GT511_RestoreState(const GT511_DeviceState_t *pState);
+
+#if GT511_ENABLE_RUN_FLOWS
 extern GT511_Error_t GT511_RunEnroll(uint32_t *pId);
 extern GT511_Error_t GT511_RunIdentify(uint32_t *pId);
 extern GT511_Error_t GT511_RunVerify(uint32_t id);
+#if GT511_ENABLE_TEMPLATE_IO
+extern GT511_Error_t GT511_RunEnrollTemplate(uint32_t *pId, uint8_t *pTemplate, uint32_t size);
+#endif
+extern GT511_Error_t GT511_SetDebounce(GT511_Mode_t mode, const GT511_Debounce_t *pDebounce);
+extern GT511_Error_t GT511_GetDebounce(GT511_Mode_t mode, GT511_Debounce_t *pDebounce);
+extern void GT511_SetPollInterval(uint32_t ticks);
+extern GT511_Error_t GT511_SetWaitTimeout(GT511_Mode_t mode, uint32_t ticks);
+extern void GT511_SetCaptureEscalation(bool enable);
+#if GT511_ENABLE_STATS
+extern GT511_Error_t GT511_GetPressStats(GT511_Mode_t mode, GT511_PressStats_t *pStats);
+extern void GT511_ClearPressStats(void);
+#endif
+#if GT511_ENABLE_EVENT_QUEUE
+extern void GT511_SetEventQueue(bool enable, GT511_Overflow_t overflow);
+extern bool GT511_GetEvent(GT511_Event_t *pEvent);
+extern void GT511_GetEventStats(GT511_EventStats_t *pStats);
+extern void GT511_ClearEventStats(void);
+#endif
+#endif
+#if GT511_ENABLE_STATS
+extern GT511_Error_t GT511_GetCommandStats(uint16_t command, GT511_CommandStats_t *pStats);
+extern GT511_Error_t GT511_CheckCommandDrift(uint16_t command, const GT511_CommandStats_t *pBaseline, uint32_t tolerance, bool *pDrifted);
+extern void GT511_ClearCommandStats(void);
+#endif
+#if GT511_ENABLE_STANDBY
+extern void GT511_SetStandby(uint32_t idleTicks, GT511_Wake_t pfnWake, void *pContext);
+extern GT511_Error_t GT511_Standby(void);
+extern GT511_Error_t GT511_Resume(void);
+extern GT511_Error_t GT511_Idle(bool *pIsReady);
+extern void GT511_GetPowerStats(GT511_PowerStats_t *pStats);
+extern void GT511_ClearPowerStats(void);
+#endif
+#if GT511_ENABLE_TRACE
+extern void GT511_SetTrace(GT511_Trace_t pfnTrace, void *pContext);
+extern uint32_t GT511_TraceWireTicks(const GT511_TraceRecord_t *pRecord, uint32_t baudrate, uint32_t ticksPerSecond);
+#endif
+#ifdef GT511_FAULT_INJECTION
+extern void GT511_SetFaultInjection(const GT511_FaultConfig_t *pConfig);
+extern void GT511_GetFaultStats(GT511_FaultStats_t *pStats);
+#endif
 
-// These are only stubs.  To be implemented some day.
-extern GT511_Error_t GT511_ChangeBaudrate(uint32_t baudrate);
+#if GT511_ENABLE_TEMPLATE_IO
 extern GT511_Error_t GT511_VerifyTemplate(uint32_t id, uint8_t *pTemplate, uint32_t size);
-extern GT511_Error_t GT511_IdentifyTemplate(uint8_t *pTemplate, uint32_t size);
+extern GT511_Error_t GT511_IdentifyTemplate(uint8_t *pTemplate, uint32_t size, uint32_t *pId);
+extern GT511_Error_t GT511_IdentifyTemplateStart(uint8_t *pTemplate, uint32_t size);
+extern GT511_Error_t GT511_IdentifyTemplateFinish(uint32_t *pId);
+extern GT511_Error_t GT511_IdentifyTemplateShards(uint8_t *pTemplate, uint32_t size, uint32_t count, GT511_SelectShard_t pfnSelect, void *pContext, uint32_t *pId, uint32_t *pShard);
+extern GT511_Error_t GT511_IdentifyTemplateBatch(uint8_t *pTemplates, uint32_t count, uint32_t *pIds, uint32_t *pDone, GT511_Preempt_t pfnPreempt, void *pContext);
 extern GT511_Error_t GT511_MakeTemplate(uint8_t *pTemplate, uint32_t size);
-extern GT511_Error_t GT511_GetImage(uint8_t *pImage, uint32_t size);
-extern GT511_Error_t GT511_GetRawImage(uint8_t *pImage, uint32_t size);
 extern GT511_Error_t GT511_GetTemplate(uint32_t id, uint8_t *pTemplate, uint32_t size);
 extern GT511_Error_t GT511_SetTemplate(uint32_t id, bool checkDuplicate, uint8_t *pTemplate, uint32_t size);
+extern GT511_Error_t GT511_GetTemplateStream(uint32_t id, GT511_WriteData_t pfnWrite, void *pContext);
+extern GT511_Error_t GT511_SetTemplateStream(uint32_t id, bool checkDuplicate, GT511_ReadData_t pfnRead, void *pContext);
+extern GT511_Error_t GT511_HashTemplate(const uint8_t *pTemplate, uint32_t size, GT511_Hash_t *pHash);
+extern GT511_Error_t GT511_GetTemplateHash(uint32_t id, GT511_Hash_t *pHash);
+extern void GT511_ForgetTemplateHashes(void);
+#endif
+#if GT511_ENABLE_IMAGE_IO
+extern GT511_Error_t GT511_GetImage(uint8_t *pImage, uint32_t size);
+extern GT511_Error_t GT511_GetRawImage(uint8_t *pImage, uint32_t size);
+extern GT511_Error_t GT511_ImageCoverage(const uint8_t *pImage, uint32_t width, uint32_t height, uint32_t *pCoverage);
+extern GT511_Error_t GT511_CaptureBaseline(uint8_t *pBaseline, uint8_t *pWork, uint32_t size, uint32_t frames);
+extern GT511_Error_t GT511_ScoreBaseline(const uint8_t *pBaseline, uint32_t size, uint32_t *pScore);
+extern GT511_Error_t GT511_SubtractBaseline(uint8_t *pImage, const uint8_t *pBaseline, uint32_t size);
+#endif
+
+// These are only stubs.  To be implemented some day.
+extern GT511_Error_t GT511_ChangeBaudrate(uint32_t baudrate);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# footprint.sh - Report the code and static RAM size of the GT-511C driver
+# for each feature configuration.
+#
+# Copyright (c) 2015, Joseph Kroesche (kroesche.org)
+# All rights reserved.
+#
+# This software is released under the FreeBSD license, found in the
+# accompanying file LICENSE.txt and at the following URL:
+#      http://www.freebsd.org/copyright/freebsd-license.html
+#
+# This software is provided as-is and without warranty.
+#
+# Usage: tools/footprint.sh
+#
+# The following environment variables can be used:
+#
+#   CC              compiler to use (default: cc)
+#   SIZE            size utility to use (default: size)
+#   NM              symbol listing utility to use (default: nm)
+#   CFLAGS          compiler flags (default: -Os -std=c99)
+#   FLASH_BUDGET    fail if flash (text + data) exceeds this many bytes
+#   RAM_BUDGET      fail if static RAM (data + bss) exceeds this many bytes
+#   BUDGET_CONFIG   configuration that the budgets apply to (default: base)
+#
+# For a cross build set CC and SIZE to the target tools, for example
+# CC=arm-none-eabi-gcc SIZE=arm-none-eabi-size CFLAGS="-Os -mthumb -mcpu=cortex-m3"
+#
+# Each configuration is also checked with tools/heapcheck.sh to make sure
+# that it does not use the heap.
+#
+
+CC=${CC:-cc}
+SIZE=${SIZE:-size}
+NM=${NM:-nm}
+export NM
+CFLAGS=${CFLAGS:-"-Os -std=c99"}
+BUDGET_CONFIG=${BUDGET_CONFIG:-base}
+
+SRCDIR=$(cd "$(dirname "$0")/.." && pwd)
+OBJ=$(mktemp /tmp/gt511_footprint.XXXXXX)
+trap 'rm -f "$OBJ"' EXIT
+
+GROUPS="RUN_FLOWS TEMPLATE_IO IMAGE_IO INFO STATS ERROR_STRINGS TRACE EVENT_QUEUE STANDBY"
+
+status=0
+
+# report one configuration: name followed by the enabled feature groups
+report()
+{
+    name=$1
+    shift
+    flags=""
+    for group in $GROUPS; do
+        enable=0
+        for want in "$@"; do
+            [ "$want" = "$group" ] && enable=1
+        done
+        flags="$flags -DGT511_ENABLE_$group=$enable"
+    done
+
+    if ! $CC $CFLAGS $flags -c "$SRCDIR/fingerprint_gt511.c" -o "$OBJ"; then
+        echo "$name: build failed"
+        status=1
+        return
+    fi
+
+    if ! "$SRCDIR/tools/heapcheck.sh" "$OBJ"; then
+        echo "$name: uses the heap"
+        status=1
+    fi
+
+    set -- $($SIZE "$OBJ" | tail -n 1)
+    flash=$(($1 + $2))
+    ram=$(($2 + $3))
+    printf "%-14s %8u %8u\n" "$name" "$flash" "$ram"
+
+    if [ "$name" = "$BUDGET_CONFIG" ]; then
+        if [ -n "$FLASH_BUDGET" ] && [ "$flash" -gt "$FLASH_BUDGET" ]; then
+            echo "$name: flash $flash exceeds budget $FLASH_BUDGET"
+            status=1
+        fi
+        if [ -n "$RAM_BUDGET" ] && [ "$ram" -gt "$RAM_BUDGET" ]; then
+            echo "$name: RAM $ram exceeds budget $RAM_BUDGET"
+            status=1
+        fi
+    fi
+}
+
+printf "%-14s %8s %8s\n" "config" "flash" "ram"
+report base
+report run_flows    RUN_FLOWS
+report template_io  TEMPLATE_IO
+report image_io     IMAGE_IO
+report info         INFO
+report stats        RUN_FLOWS STATS
+report error_string ERROR_STRINGS
+report trace        TRACE
+report event_queue  RUN_FLOWS EVENT_QUEUE
+report standby      STANDBY
+report all          $GROUPS
+
+exit $status
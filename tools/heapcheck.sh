@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# heapcheck.sh - Check that compiled GT-511C driver objects do not use the
+# heap.
+#
+# Copyright (c) 2015, Joseph Kroesche (kroesche.org)
+# All rights reserved.
+#
+# This software is released under the FreeBSD license, found in the
+# accompanying file LICENSE.txt and at the following URL:
+#      http://www.freebsd.org/copyright/freebsd-license.html
+#
+# This software is provided as-is and without warranty.
+#
+# Usage: tools/heapcheck.sh OBJECT...
+#
+# The driver must never use the heap.  The source poisons the allocation
+# functions for GCC and Clang, but other compilers ignore that, so this
+# checks the symbols that each object needs from the C library instead.
+# It fails if any object refers to a heap allocation function.
+#
+# The following environment variables can be used:
+#
+#   NM              symbol listing utility to use (default: nm)
+#
+
+NM=${NM:-nm}
+
+HEAP_FUNCS="malloc calloc realloc free aligned_alloc posix_memalign strdup"
+
+if [ $# -eq 0 ]; then
+    echo "usage: $0 OBJECT..."
+    exit 2
+fi
+
+status=0
+for obj in "$@"; do
+    if ! symbols=$($NM -u "$obj"); then
+        echo "$obj: cannot list symbols"
+        status=1
+        continue
+    fi
+    for func in $HEAP_FUNCS; do
+        # some targets add a leading underscore to C symbols
+        if echo "$symbols" | grep -Eq "(^|[[:space:]])_?${func}$"; then
+            echo "$obj: uses heap function $func"
+            status=1
+        fi
+    done
+done
+
+exit $status